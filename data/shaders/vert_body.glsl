@@ -1,23 +1,37 @@
 #version 330 core
 
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aNormal;
+// Packed vertex, see SPackedVertex
+layout(location = 0) in vec3 aPos; // lattice position
+layout(location = 1) in vec2 aNormal; // octahedral
 layout(location = 3) in vec4 aColorData;
 
 uniform mat4 uModel;
 uniform mat4 uView;
 uniform mat4 uProjection;
 
+uniform float uPositionScale;
+uniform vec3 uPositionOffset;
+
 out vec3 FragPos;
 out vec3 Normal;
 out vec4 vColorData;
 // out float v_view_z; // Removed
 
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
 void main()
 {
-	vec4 worldPos = uModel * vec4(aPos, 1.0);
+	vec3 LocalPos = aPos * uPositionScale + uPositionOffset;
+	vec4 worldPos = uModel * vec4(LocalPos, 1.0);
 	FragPos = vec3(worldPos);
-	Normal = mat3(transpose(inverse(uModel))) * aNormal;
+	Normal = mat3(transpose(inverse(uModel))) * DecodeOctahedral(aNormal);
 	vColorData = aColorData;
 
 	gl_Position = uProjection * uView * worldPos;
@@ -0,0 +1,48 @@
+#version 460 core
+
+// Osculating ellipses, see SGPUOrbit in trajectories.h
+struct SOrbit
+{
+	vec3 BodyOffset;
+	float SemiMajorAxis;
+	vec3 PeriapsisDir;
+	float Eccentricity;
+	vec3 NormalDir;
+	uint Color;
+	float EccentricAnomaly;
+	float Padding0;
+	float Padding1;
+	float Padding2;
+};
+
+layout(std430, binding = 0) readonly buffer Orbits
+{
+	SOrbit s_aOrbits[];
+};
+
+uniform mat4 View;
+uniform mat4 Projection;
+uniform float u_logDepthF;
+uniform int u_Segments;
+
+out vec4 v_Color;
+out float v_FragDepthW;
+
+void main()
+{
+	SOrbit Orbit = s_aOrbits[gl_InstanceID];
+
+	// Even steps in eccentric anomaly, starting and ending at the body. The offset to the body is built from
+	// cos(E) - cos(E0) = -2 sin(m) sin(d) and sin(E) - sin(E0) = 2 cos(m) sin(d) so it stays precise close to it.
+	float d = 3.14159265359 * float(gl_VertexID) / float(u_Segments);
+	float m = Orbit.EccentricAnomaly + d;
+	float a = Orbit.SemiMajorAxis;
+	float b = a * sqrt(1.0 - Orbit.Eccentricity * Orbit.Eccentricity);
+	float s = 2.0 * sin(d);
+
+	vec3 Pos = Orbit.BodyOffset + Orbit.PeriapsisDir * (-a * sin(m) * s) + Orbit.NormalDir * (b * cos(m) * s);
+
+	v_Color = unpackUnorm4x8(Orbit.Color);
+	gl_Position = Projection * View * vec4(Pos, 1.0);
+	v_FragDepthW = gl_Position.w;
+}
@@ -1,21 +1,162 @@
-#version 330 core
-layout(location = 0) in vec3 aPos;
+#version 460 core
+
+#define BLOCK_SIZE 16u
+#define NO_LINK 0xffffffffu
+
+// Samples of all trajectories as offsets to the anchor of their block, see CTrajectories
+struct SSample
+{
+	vec3 Offset;
+	uint Tick;
+};
+
+struct SAnchor
+{
+	vec3 High;
+	uint Color;
+	vec3 Low;
+	float Padding;
+};
+
+layout(std430, binding = 0) readonly buffer Samples
+{
+	SSample s_aSamples[];
+};
+
+// Real-time and predicted end of every path
+struct SEnd
+{
+	vec3 High;
+	uint Tick;
+	vec3 Low;
+	uint Link;
+	uint Color;
+	uint Padding0;
+	uint Padding1;
+	uint Padding2;
+};
+
+layout(std430, binding = 1) readonly buffer Anchors
+{
+	SAnchor s_aAnchors[];
+};
+
+layout(std430, binding = 2) readonly buffer Ends
+{
+	SEnd s_aEnds[];
+};
 
-uniform mat4 Model;
 uniform mat4 View;
 uniform mat4 Projection;
 uniform float u_logDepthF;
 
-out float Alpha;
+// Current position of the reference body relative to the camera
+uniform vec3 u_ViewOffset;
+uniform uint u_RealTick;
+
+// Region of this frame in the end buffer. With u_DrawEnds every 4 vertices are the two segments joining
+// the ends of a path to its ring.
+uniform uint u_EndBase;
+uniform bool u_DrawEnds;
+
+// Ring of the reference body, u_RefCount is 0 without one
+uniform uint u_RefBase;
+uniform uint u_RefCapacity;
+uniform uint u_RefTail;
+uniform uint u_RefCount;
+uniform uint u_RefEnd;
+
+out vec4 v_Color;
 out float v_FragDepthW;
 
+struct SPoint
+{
+	vec3 High;
+	vec3 Low;
+	vec3 Offset;
+	uint Tick;
+	uint Color;
+};
+
+SPoint RingPoint(uint Slot)
+{
+	SAnchor Anchor = s_aAnchors[Slot / BLOCK_SIZE];
+	SSample Sample = s_aSamples[Slot];
+	return SPoint(Anchor.High, Anchor.Low, Sample.Offset, Sample.Tick, Anchor.Color);
+}
+
+SPoint EndPoint(uint i)
+{
+	SEnd End = s_aEnds[u_EndBase + i];
+	return SPoint(End.High, End.Low, vec3(0.0), End.Tick, End.Color);
+}
+
+// Point i of the reference path, its first and last one are the ends
+SPoint RefPoint(uint i)
+{
+	if(i == 0u)
+		return EndPoint(u_RefEnd);
+	if(i == u_RefCount - 1u)
+		return EndPoint(u_RefEnd + 1u);
+	return RingPoint(u_RefBase + (u_RefTail + i) % u_RefCapacity);
+}
+
+// Position of a relative to b. The high and low parts of the anchors are subtracted
+// separately so nearby bodies keep their precision far away from the origin.
+vec3 Delta(SPoint a, SPoint b)
+{
+	return (a.High - b.High) + (a.Low - b.Low) + (a.Offset - b.Offset);
+}
+
+// Ticks only keep their low 32 bits, so compare them relative to the real-time tick
+int RelTick(uint Tick)
+{
+	return int(Tick - u_RealTick);
+}
+
 void main()
 {
-	if(aPos == vec3(0.0, 0.0, 0.0))
-		Alpha = 0.0;
+	SPoint Point;
+	if(u_DrawEnds)
+	{
+		// End, its neighbour in the ring, the neighbour of the other end, the other end
+		uint Corner = uint(gl_VertexID) % 4u;
+		uint End = uint(gl_VertexID) / 4u * 2u + Corner / 2u;
+		Point = EndPoint(End);
+		if(Corner == 1u || Corner == 2u)
+		{
+			uint Link = s_aEnds[u_EndBase + End].Link;
+			Point = Link != NO_LINK ? RingPoint(Link) : EndPoint(End | 1u);
+		}
+	}
 	else
-		Alpha = 1.0;
+		Point = RingPoint(uint(gl_VertexID));
+	vec3 RelPos = Point.High + Point.Low + Point.Offset;
+
+	if(u_RefCount > 0u)
+	{
+		int Tick = RelTick(Point.Tick);
+
+		// First reference sample not before this one
+		uint Lo = 0u, Hi = u_RefCount - 1u;
+		while(Lo < Hi)
+		{
+			uint Mid = (Lo + Hi) / 2u;
+			if(RelTick(RefPoint(Mid).Tick) < Tick)
+				Lo = Mid + 1u;
+			else
+				Hi = Mid;
+		}
+
+		SPoint R1 = RefPoint(Lo);
+		SPoint R0 = RefPoint(max(Lo, 1u) - 1u);
+		int Tick0 = RelTick(R0.Tick), Tick1 = RelTick(R1.Tick);
+		float f = Tick1 > Tick0 ? clamp(float(Tick1 - Tick) / float(Tick1 - Tick0), 0.0, 1.0) : 0.0;
+
+		RelPos = Delta(Point, R1) - Delta(R0, R1) * f;
+	}
 
-	gl_Position = Projection * View * Model * vec4(aPos, 1.0);
+	v_Color = unpackUnorm4x8(Point.Color);
+	gl_Position = Projection * View * vec4(u_ViewOffset + RelPos, 1.0);
 	v_FragDepthW = gl_Position.w;
 }
@@ -253,13 +253,25 @@ void CGraphics::OnRender(CStarSystem &StarSystem)
 			if(ImGui::SliderInt("Prediction Duration", &m_Trajectories.m_PredictionDuration, 1e3, 1e9))
 				bTrajChanged = true;
 
-			if(ImGui::SliderInt("Sample Rate", &m_Trajectories.m_SampleRate, 1, 5000))
+			if(ImGui::SliderFloat("Max Sample Angle", &m_Trajectories.m_MaxSampleAngle, 0.1f, 20.0f, "%.1f deg"))
 				bTrajChanged = true;
 
+			if(ImGui::SliderInt("Min Samples", &m_Trajectories.m_MinSamples, 2, 1024))
+				bTrajChanged = true;
+
+			if(ImGui::SliderFloat("Prediction Tolerance", &m_Trajectories.m_PredictionTolerance, 1e-12f, 1e-6f, "%.1e", ImGuiSliderFlags_Logarithmic))
+				bTrajChanged = true;
+
+			ImGui::SliderInt("Resync Interval", &m_Trajectories.m_ResyncInterval, 0, 1000000);
+
+			ImGui::Checkbox("Analytic Orbits", &m_Trajectories.m_AnalyticOrbits);
+			if(m_Trajectories.m_AnalyticOrbits)
+				ImGui::SliderFloat("Max Perturbation", &m_Trajectories.m_MaxOrbitPerturbation, 1e-5f, 1.0f, "%.1e", ImGuiSliderFlags_Logarithmic);
+
 			if(bTrajChanged)
 				m_bPredictionResetRequested = true;
 
-			ImGui::TextColored(ImVec4(0.7, 0.7, 0.7, 1.0), "Visual Points: %d", m_Trajectories.GetMaxVisualPoints());
+			ImGui::TextColored(ImVec4(0.7, 0.7, 0.7, 1.0), "Stored Points: %d", m_Trajectories.GetStoredPointCount());
 			float durationHours = (float)m_Trajectories.m_PredictionDuration * (float)StarSystem.m_DeltaTime / 3600.0f;
 			ImGui::TextColored(ImVec4(0.7, 0.7, 0.7, 1.0), "Simulated Time: %.1f Hours", durationHours);
 		}
@@ -271,8 +283,53 @@ void CGraphics::OnRender(CStarSystem &StarSystem)
 				auto *pMesh = m_BodyMeshes[m_Camera.m_pFocusedBody->m_Id];
 
 				ImGui::Checkbox("Visualize Octree", &pMesh->m_bVisualizeOctree);
+				ImGui::Checkbox("Cube-Sphere Tiles", &pMesh->m_bCubeSphere);
+				ImGui::SameLine();
+				ImGui::Text("%d nodes", pMesh->GetNumNodes());
+				ImGui::Checkbox("Grid Normals", &pMesh->m_bGridNormals);
+				ImGui::Checkbox("Height Cache", &pMesh->m_bHeightCache);
+				ImGui::Checkbox("Octave Culling", &pMesh->m_bOctaveCulling);
+				ImGui::Checkbox("Sample Cache", &pMesh->m_bSampleCache);
+				ImGui::SameLine();
+				ImGui::Text("%.1f%% hits", pMesh->m_SampleCache.GetHitRate() * 100.0);
+				if(ImGui::Button("Benchmark Meshers"))
+					pMesh->BenchmarkMeshers();
 				ImGui::SliderFloat("Split Ratio", &pMesh->m_SplitMultiplier, 0.01f, 1.0f);
 				ImGui::SliderFloat("Merge Ratio", &pMesh->m_MergeMultiplier, 0.01f, 1.0f);
+				ImGui::SliderFloat("LOD Budget (ms)", &pMesh->m_LodBudget, 0.1f, 8.0f);
+				ImGui::SameLine();
+				ImGui::Text("%d nodes", pMesh->m_NumLodEvaluations);
+				ImGui::SliderFloat("LOD Hysteresis (s)", &pMesh->m_LodHysteresis, 0.0f, 3.0f);
+				ImGui::Checkbox("Prefetch", &pMesh->m_bPrefetch);
+				ImGui::SameLine();
+				ImGui::SliderFloat("Look-Ahead (s)", &pMesh->m_PrefetchTime, 0.0f, 10.0f);
+				CProceduralMesh::SPrefetchStats &Stats = pMesh->m_PrefetchStats;
+				ImGui::Text("%d hits, %d late, %d misses, %d wasted", Stats.m_Hits, Stats.m_Late, Stats.m_Misses, Stats.m_Wasted);
+				ImGui::SameLine();
+				if(ImGui::Button("Reset##Prefetch"))
+					Stats = CProceduralMesh::SPrefetchStats();
+				ImGui::Text("Cancelled: %d queued, %d running, %d done (%.0f ms)", pMesh->m_NumDroppedTasks.load(), pMesh->m_NumAbortedTasks.load(),
+					pMesh->m_NumDiscardedMeshes.load(), (double)pMesh->m_WastedMicroseconds.load() / 1000.0);
+				ImGui::Checkbox("Mesh Cache", &pMesh->m_bMeshCache);
+				ImGui::SameLine();
+				ImGui::Checkbox("Keep on GPU", &pMesh->m_bMeshCacheGPU);
+				ImGui::SliderFloat("GPU Budget (MB)", &pMesh->m_MeshCacheGPUBudget, 0.0f, 1024.0f);
+				ImGui::SliderFloat("CPU Budget (MB)", &pMesh->m_MeshCacheCPUBudget, 0.0f, 1024.0f);
+				ImGui::Text("%d hits, %d misses, %d meshes, %.1f MB GPU, %.1f MB CPU", pMesh->m_MeshCacheHits, pMesh->m_MeshCacheMisses, (int)pMesh->m_MeshCache.size(),
+					pMesh->m_MeshCacheGPUBytes / 1048576.0, pMesh->m_MeshCacheCPUBytes / 1048576.0);
+				ImGui::SameLine();
+				if(ImGui::Button("Reset##MeshCache"))
+					pMesh->m_MeshCacheHits = pMesh->m_MeshCacheMisses = 0;
+				if(pMesh->m_bTreeIsCubeSphere)
+				{
+					ImGui::Checkbox("Occlusion Culling", &pMesh->m_bOcclusionCulling);
+					ImGui::SliderInt("Occlusion Width", &pMesh->m_OcclusionWidth, 64, 1024);
+					ImGui::SliderInt("Max Occluders", &pMesh->m_MaxOccluders, 1, 256);
+					ImGui::Text("%d occluders, %d nodes occluded, %d meshes drawn (%.2f ms)", pMesh->m_NumOccluders, pMesh->m_NumOccludedNodes,
+						pMesh->m_NumDrawnMeshes, pMesh->m_OcclusionTime);
+				}
+				else
+					ImGui::TextDisabled("Occlusion culling needs cube-sphere tiles");
 
 				if(pMesh->m_MergeMultiplier >= pMesh->m_SplitMultiplier)
 					ImGui::TextColored(ImVec4(1, 0, 0, 1), "Warning: Merge >= Split causes flickering!");
@@ -302,7 +359,7 @@ void CGraphics::OnRender(CStarSystem &StarSystem)
 		ImGui::Text("Current TPS: %d", (int)(m_pStarSystem->m_HPS * (3600.0 / m_pStarSystem->m_DeltaTime)));
 		int Count = 0;
 		for(auto &Mesh : m_BodyMeshes)
-			Count += Mesh.second->m_GenerationQueue.size();
+			Count += Mesh.second->m_vGenerationQueue.size();
 		ImGui::Text("Gen Queue Size: %d", Count);
 		ImGui::End();
 	}
@@ -0,0 +1,225 @@
+#include "occlusion.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+void COcclusionBuffer::Clear(int Width, const glm::mat4 &View, const glm::mat4 &Projection)
+{
+	// The aspect ratio and the near plane of a perspective projection
+	m_Width = std::max((Width + 3) & ~3, 4);
+	m_Height = std::max((int)std::lround(m_Width * Projection[0][0] / Projection[1][1]), 1);
+	m_Near = Projection[3][2] / (Projection[2][2] - 1.0f);
+	m_ViewProjection = Projection * View;
+	m_vDepth.assign((size_t)m_Width * m_Height, FLT_MAX);
+	m_NumTriangles = 0;
+	m_bReady = false;
+}
+
+void COcclusionBuffer::DrawTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c)
+{
+	const glm::vec4 aIn[3] = {m_ViewProjection * glm::vec4(a, 1.0f), m_ViewProjection * glm::vec4(b, 1.0f), m_ViewProjection * glm::vec4(c, 1.0f)};
+	if(aIn[0].w >= m_Near && aIn[1].w >= m_Near && aIn[2].w >= m_Near)
+	{
+		RasterizeTriangle(aIn[0], aIn[1], aIn[2]);
+		return;
+	}
+
+	// Clipped at the near plane, the other planes are left to the bounding box of the rasterizer
+	glm::vec4 aOut[4];
+	int Count = 0;
+	for(int i = 0; i < 3; ++i)
+	{
+		const glm::vec4 &From = aIn[i], &To = aIn[(i + 1) % 3];
+		if(From.w >= m_Near)
+			aOut[Count++] = From;
+		if((From.w >= m_Near) != (To.w >= m_Near))
+			aOut[Count++] = From + (To - From) * ((m_Near - From.w) / (To.w - From.w));
+	}
+	for(int i = 2; i < Count; ++i)
+		RasterizeTriangle(aOut[0], aOut[i - 1], aOut[i]);
+}
+
+void COcclusionBuffer::RasterizeTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c)
+{
+	// Pixel coordinates and the reciprocal depth, which is linear across the screen
+	const glm::vec3 aScreen[3] = {
+		glm::vec3((a.x / a.w * 0.5f + 0.5f) * m_Width, (a.y / a.w * 0.5f + 0.5f) * m_Height, 1.0f / a.w),
+		glm::vec3((b.x / b.w * 0.5f + 0.5f) * m_Width, (b.y / b.w * 0.5f + 0.5f) * m_Height, 1.0f / b.w),
+		glm::vec3((c.x / c.w * 0.5f + 0.5f) * m_Width, (c.y / c.w * 0.5f + 0.5f) * m_Height, 1.0f / c.w),
+	};
+	float Area = (aScreen[1].x - aScreen[0].x) * (aScreen[2].y - aScreen[0].y) - (aScreen[2].x - aScreen[0].x) * (aScreen[1].y - aScreen[0].y);
+	if(!(std::abs(Area) > 1e-6f))
+		return;
+
+	const float MinX = std::min({aScreen[0].x, aScreen[1].x, aScreen[2].x}), MaxX = std::max({aScreen[0].x, aScreen[1].x, aScreen[2].x});
+	const float MinY = std::min({aScreen[0].y, aScreen[1].y, aScreen[2].y}), MaxY = std::max({aScreen[0].y, aScreen[1].y, aScreen[2].y});
+	if(MaxX < 0.0f || MaxY < 0.0f || MinX > (float)m_Width || MinY > (float)m_Height)
+		return;
+	// Whole groups of 4 pixels, the edge tests reject the ones outside
+	const int x0 = std::max((int)std::floor(MinX), 0) & ~3, x1 = std::min((int)std::ceil(MaxX), m_Width - 1);
+	const int y0 = std::max((int)std::floor(MinY), 0), y1 = std::min((int)std::ceil(MaxY), m_Height - 1);
+	++m_NumTriangles;
+
+	// Edge functions, positive inside for either winding, and the reciprocal depth as planes over the screen
+	const float Sign = Area > 0.0f ? 1.0f : -1.0f;
+	float aEdgeX[3], aEdgeY[3], aEdgeC[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		const glm::vec3 &From = aScreen[i], &To = aScreen[(i + 1) % 3];
+		aEdgeX[i] = -(To.y - From.y) * Sign;
+		aEdgeY[i] = (To.x - From.x) * Sign;
+		aEdgeC[i] = -(aEdgeX[i] * From.x + aEdgeY[i] * From.y);
+	}
+	// The edge opposite of a vertex weights it
+	float DepthX = 0.0f, DepthY = 0.0f, DepthC = 0.0f;
+	for(int i = 0; i < 3; ++i)
+	{
+		const float Weight = aScreen[(i + 2) % 3].z / std::abs(Area);
+		DepthX += aEdgeX[i] * Weight;
+		DepthY += aEdgeY[i] * Weight;
+		DepthC += aEdgeC[i] * Weight;
+	}
+
+	for(int y = y0; y <= y1; ++y)
+	{
+		const float py = (float)y + 0.5f;
+		float *pRow = &m_vDepth[(size_t)y * m_Width];
+		float aRowEdge[3];
+		for(int i = 0; i < 3; ++i)
+			aRowEdge[i] = aEdgeY[i] * py + aEdgeC[i];
+		const float RowDepth = DepthY * py + DepthC;
+#ifdef OCCLUSION_SSE2
+		const __m128 Zero = _mm_setzero_ps();
+		const __m128 Step = _mm_set1_ps(aEdgeX[0] * 4.0f), Step1 = _mm_set1_ps(aEdgeX[1] * 4.0f), Step2 = _mm_set1_ps(aEdgeX[2] * 4.0f);
+		const __m128 DepthStep = _mm_set1_ps(DepthX * 4.0f);
+		const __m128 px = _mm_add_ps(_mm_set1_ps((float)x0 + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+		__m128 Edge0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(aEdgeX[0]), px), _mm_set1_ps(aRowEdge[0]));
+		__m128 Edge1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(aEdgeX[1]), px), _mm_set1_ps(aRowEdge[1]));
+		__m128 Edge2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(aEdgeX[2]), px), _mm_set1_ps(aRowEdge[2]));
+		__m128 InvDepth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(DepthX), px), _mm_set1_ps(RowDepth));
+		for(int x = x0; x <= x1; x += 4)
+		{
+			const __m128 Inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(Edge0, Zero), _mm_cmpge_ps(Edge1, Zero)), _mm_cmpge_ps(Edge2, Zero));
+			if(_mm_movemask_ps(Inside))
+			{
+				const __m128 Old = _mm_loadu_ps(pRow + x);
+				const __m128 New = _mm_min_ps(Old, _mm_div_ps(_mm_set1_ps(1.0f), InvDepth));
+				_mm_storeu_ps(pRow + x, _mm_or_ps(_mm_and_ps(Inside, New), _mm_andnot_ps(Inside, Old)));
+			}
+			Edge0 = _mm_add_ps(Edge0, Step);
+			Edge1 = _mm_add_ps(Edge1, Step1);
+			Edge2 = _mm_add_ps(Edge2, Step2);
+			InvDepth = _mm_add_ps(InvDepth, DepthStep);
+		}
+#else
+		for(int x = x0; x <= x1; ++x)
+		{
+			const float px = (float)x + 0.5f;
+			if(aEdgeX[0] * px + aRowEdge[0] >= 0.0f && aEdgeX[1] * px + aRowEdge[1] >= 0.0f && aEdgeX[2] * px + aRowEdge[2] >= 0.0f)
+				pRow[x] = std::min(pRow[x], 1.0f / (DepthX * px + RowDepth));
+		}
+#endif
+	}
+}
+
+void COcclusionBuffer::Finish()
+{
+	// The depth is only known at the pixel centers, the part of a pixel on the silhouette of an occluder may be
+	// uncovered. Every texel takes the farthest of its neighbours as well.
+	if(m_vLevels.empty())
+		m_vLevels.resize(1);
+	SLevel &Base = m_vLevels[0];
+	Base.m_Width = m_Width;
+	Base.m_Height = m_Height;
+	Base.m_vDepth.resize(m_vDepth.size());
+	m_vRowMax.resize(m_vDepth.size());
+	for(int y = 0; y < m_Height; ++y)
+	{
+		const float *pRow = &m_vDepth[(size_t)y * m_Width];
+		float *pOut = &m_vRowMax[(size_t)y * m_Width];
+		for(int x = 0; x < m_Width; ++x)
+			pOut[x] = std::max({pRow[std::max(x - 1, 0)], pRow[x], pRow[std::min(x + 1, m_Width - 1)]});
+	}
+	for(int y = 0; y < m_Height; ++y)
+	{
+		const float *pAbove = &m_vRowMax[(size_t)std::max(y - 1, 0) * m_Width];
+		const float *pRow = &m_vRowMax[(size_t)y * m_Width];
+		const float *pBelow = &m_vRowMax[(size_t)std::min(y + 1, m_Height - 1) * m_Width];
+		float *pOut = &Base.m_vDepth[(size_t)y * m_Width];
+		for(int x = 0; x < m_Width; ++x)
+			pOut[x] = std::max({pAbove[x], pRow[x], pBelow[x]});
+	}
+
+	// Halved down to a single texel, the levels keep their storage between frames
+	size_t NumLevels = 1;
+	while(m_vLevels[NumLevels - 1].m_Width > 1 || m_vLevels[NumLevels - 1].m_Height > 1)
+	{
+		if(m_vLevels.size() == NumLevels)
+			m_vLevels.emplace_back();
+		const SLevel &Fine = m_vLevels[NumLevels - 1];
+		SLevel &Coarse = m_vLevels[NumLevels++];
+		Coarse.m_Width = (Fine.m_Width + 1) / 2;
+		Coarse.m_Height = (Fine.m_Height + 1) / 2;
+		Coarse.m_vDepth.resize((size_t)Coarse.m_Width * Coarse.m_Height);
+		for(int y = 0; y < Coarse.m_Height; ++y)
+		{
+			for(int x = 0; x < Coarse.m_Width; ++x)
+			{
+				const int fx = x * 2, fy = y * 2;
+				const int fx1 = std::min(fx + 1, Fine.m_Width - 1), fy1 = std::min(fy + 1, Fine.m_Height - 1);
+				Coarse.m_vDepth[(size_t)y * Coarse.m_Width + x] = std::max(std::max(Fine.m_vDepth[(size_t)fy * Fine.m_Width + fx], Fine.m_vDepth[(size_t)fy * Fine.m_Width + fx1]),
+					std::max(Fine.m_vDepth[(size_t)fy1 * Fine.m_Width + fx], Fine.m_vDepth[(size_t)fy1 * Fine.m_Width + fx1]));
+			}
+		}
+	}
+	m_vLevels.resize(NumLevels);
+	m_bReady = true;
+}
+
+bool COcclusionBuffer::IsOccluded(const glm::vec3 *pCorners) const
+{
+	if(!m_bReady)
+		return false;
+
+	// Screen rectangle and nearest depth of the corners, a box reaching past the near plane is in front of everything
+	float MinX = FLT_MAX, MaxX = -FLT_MAX, MinY = FLT_MAX, MaxY = -FLT_MAX, MinDepth = FLT_MAX;
+	for(int i = 0; i < 8; ++i)
+	{
+		const glm::vec4 Clip = m_ViewProjection * glm::vec4(pCorners[i], 1.0f);
+		if(Clip.w < m_Near)
+			return false;
+		const float x = (Clip.x / Clip.w * 0.5f + 0.5f) * m_Width, y = (Clip.y / Clip.w * 0.5f + 0.5f) * m_Height;
+		MinX = std::min(MinX, x);
+		MaxX = std::max(MaxX, x);
+		MinY = std::min(MinY, y);
+		MaxY = std::max(MaxY, y);
+		MinDepth = std::min(MinDepth, Clip.w);
+	}
+	if(MaxX < 0.0f || MaxY < 0.0f || MinX >= (float)m_Width || MinY >= (float)m_Height)
+		return false;
+
+	// The level where the rectangle covers at most 2 x 2 texels
+	int x0 = std::max((int)std::floor(MinX), 0), x1 = std::min((int)std::floor(MaxX), m_Width - 1);
+	int y0 = std::max((int)std::floor(MinY), 0), y1 = std::min((int)std::floor(MaxY), m_Height - 1);
+	size_t Level = 0;
+	while(x1 - x0 > 1 || y1 - y0 > 1)
+	{
+		x0 >>= 1;
+		x1 >>= 1;
+		y0 >>= 1;
+		y1 >>= 1;
+		++Level;
+	}
+
+	const SLevel &Texels = m_vLevels[Level];
+	for(int y = y0; y <= y1; ++y)
+		for(int x = x0; x <= x1; ++x)
+			if(Texels.m_vDepth[(size_t)y * Texels.m_Width + x] >= MinDepth)
+				return false;
+	return true;
+}
@@ -0,0 +1,43 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Low resolution depth buffer the nearest terrain is rasterized into on the CPU, with a max hierarchy over it to
+// test boxes against. Positions are relative to the camera, the depth is the distance along the view direction.
+class COcclusionBuffer
+{
+public:
+	// Width is rounded up to a multiple of 4, the height follows from the aspect ratio of the projection
+	void Clear(int Width, const glm::mat4 &View, const glm::mat4 &Projection);
+	// Occluders have to be inside the solid, both sides of the triangle occlude
+	void DrawTriangle(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c);
+	// Builds the hierarchy, nothing is occluded before
+	void Finish();
+	// True if the whole box, given by its 8 corners, is behind what was drawn
+	bool IsOccluded(const glm::vec3 *pCorners) const;
+
+	int GetWidth() const { return m_Width; }
+	int GetHeight() const { return m_Height; }
+	int m_NumTriangles = 0;
+
+private:
+	struct SLevel
+	{
+		int m_Width = 0, m_Height = 0;
+		std::vector<float> m_vDepth;
+	};
+
+	void RasterizeTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c);
+
+	int m_Width = 0, m_Height = 0;
+	float m_Near = 0.0f;
+	glm::mat4 m_ViewProjection;
+	std::vector<float> m_vDepth; // nearest occluder at the pixel centers
+	std::vector<float> m_vRowMax;
+	std::vector<SLevel> m_vLevels; // farthest depth over each texel
+	bool m_bReady = false;
+};
+
+#endif // OCCLUSION_H
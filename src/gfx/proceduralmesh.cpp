@@ -1,18 +1,24 @@
 #include "proceduralmesh.h"
+#include "../sim/starsystem.h"
 #include "camera.h"
 #include "glm/geometric.hpp"
 #include "marchingcubes.h"
+#include "terrain/cubesphere.h"
 #include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
 #include <embedded_shaders.h>
 
 #include <glm/gtc/matrix_access.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
-#include <unordered_map>
 
 // =========================================================
 // HELPER FUNCTIONS
@@ -37,70 +43,162 @@ void CProceduralMesh::CalculateFrustum(const CCamera &Camera)
 	}
 }
 
-// Checks if a Sphere (in Camera-Relative World Space) is inside the frustum
-bool IsSphereInFrustum(const std::array<glm::vec4, 6> &planes, const glm::vec3 &center, float radius)
+// Checks if a Sphere (in Camera-Relative World Space) is inside the frustum.
+// pMargin receives how far the sphere has to move relative to the planes for the result to change.
+bool IsSphereInFrustum(const std::array<glm::vec4, 6> &planes, const glm::vec3 &center, float radius, float *pMargin = nullptr)
 {
+	float Inside = FLT_MAX, Outside = 0.0f;
 	for(int i = 0; i < 6; ++i)
 	{
 		float Dist = glm::dot(glm::vec3(planes[i]), center) + planes[i].w;
 		if(Dist < -radius)
-			return false;
+		{
+			if(!pMargin)
+				return false;
+			Outside = std::max(Outside, -radius - Dist);
+		}
+		else
+			Inside = std::min(Inside, Dist + radius);
 	}
-	return true;
+	if(pMargin)
+		*pMargin = Outside > 0.0f ? Outside : Inside;
+	return Outside == 0.0f;
 }
 
 // Distance to Axis Aligned Bounding Box (All inputs must be in the SAME Local Space)
-double GetDistanceToBox(const Vec3 &pointLocal, const Vec3 &boxCenterLocal, double boxSize)
+double GetDistanceToBox(const Vec3 &pointLocal, const Vec3 &boxCenterLocal, const Vec3 &boxHalfSize)
 {
-	double HalfSize = boxSize * 0.5;
 	// Calculate delta from the box surface
-	double dx = std::max(0.0, std::abs(pointLocal.x - boxCenterLocal.x) - HalfSize);
-	double dy = std::max(0.0, std::abs(pointLocal.y - boxCenterLocal.y) - HalfSize);
-	double dz = std::max(0.0, std::abs(pointLocal.z - boxCenterLocal.z) - HalfSize);
+	double dx = std::max(0.0, std::abs(pointLocal.x - boxCenterLocal.x) - boxHalfSize.x);
+	double dy = std::max(0.0, std::abs(pointLocal.y - boxCenterLocal.y) - boxHalfSize.y);
+	double dz = std::max(0.0, std::abs(pointLocal.z - boxCenterLocal.z) - boxHalfSize.z);
 
 	return std::sqrt(dx * dx + dy * dy + dz * dz);
 }
 
-bool IsChunkOccluded(const Vec3 &chunkCenterRelPlanet, double chunkSize, const Vec3 &camPosRelPlanet, double planetRadius)
+// True if the whole bounding sphere of the chunk, no further than chunkMaxRadius from the center, is behind the horizon
+// of the occluder sphere. pMargin receives how far the camera has to move for the result to change.
+bool IsChunkOccluded(const Vec3 &chunkCenterRelPlanet, double chunkBoundingRadius, double chunkMaxRadius, const Vec3 &camPosRelPlanet, double occluderRadius, double *pMargin = nullptr)
 {
-	double DistToCam = camPosRelPlanet.length();
-	// Don't cull if we are very close (on top of the chunk)
-	if(DistToCam < planetRadius + chunkSize * 4.0)
+	const double DistToCam = camPosRelPlanet.length();
+	const double DistToChunk = chunkCenterRelPlanet.length();
+	if(DistToCam <= occluderRadius || chunkBoundingRadius >= DistToChunk)
+	{
+		if(pMargin)
+			*pMargin = chunkBoundingRadius >= DistToChunk ? DBL_MAX : occluderRadius - DistToCam;
 		return false;
+	}
 
-	// Horizon Culling Math
-	double HorizonDistFromCenter = (planetRadius * planetRadius) / DistToCam;
-	Vec3 CamDir = camPosRelPlanet / DistToCam;
-	double ProjectedDist = chunkCenterRelPlanet.dot(CamDir);
-	double ChunkBoundingRadius = chunkSize * 0.9; // Conservative radius
+	// A point is hidden if its angle to the camera around the center is larger than the ones of both tangents to
+	// the occluder together. The nearest point of the chunk has at least the angle of its center less what the
+	// sphere subtends, and at most the maximal radius.
+	const double ChunkAngle = std::atan2(chunkCenterRelPlanet.cross(camPosRelPlanet).length(), chunkCenterRelPlanet.dot(camPosRelPlanet)) - std::asin(chunkBoundingRadius / DistToChunk);
+	const double MaxRadius = std::max(std::min(chunkMaxRadius, DistToChunk + chunkBoundingRadius), occluderRadius);
+	const double HorizonAngle = std::acos(occluderRadius / DistToCam) + std::acos(occluderRadius / MaxRadius);
 
-	// If the chunk is "below" the horizon line relative to the camera
-	if(ProjectedDist + ChunkBoundingRadius < HorizonDistFromCenter)
-		return true;
+	if(pMargin)
+	{
+		// Both angles change at most by this per distance the camera moves, as long as it stays above Low
+		const double Low = occluderRadius + (DistToCam - occluderRadius) * 0.5;
+		const double Lipschitz = (1.0 + occluderRadius / std::sqrt(Low * Low - occluderRadius * occluderRadius)) / Low;
+		*pMargin = std::min(DistToCam - Low, std::abs(ChunkAngle - HorizonAngle) / Lipschitz);
+	}
+	return ChunkAngle > HorizonAngle;
+}
 
-	return false;
+// Equal-angle cube-sphere of the tiles, t in [-1, 1] across a face. The face edges map exactly to the cube edges,
+// so border points of tiles on neighbouring faces come out the same.
+static double TileWarp(double t)
+{
+	return std::abs(t) == 1.0 ? t : std::tan(t * PI * 0.25);
 }
 
-// =========================================================
-// CProceduralMesh Implementation
-// =========================================================
+static Vec3 TileDirection(int Face, double tu, double tv)
+{
+	return CubeFaceToDirection(Face, TileWarp(tu), TileWarp(tv));
+}
+
+// Coordinate t of a point of a lattice with Size cells across the face
+static double LatticeCoordinate(double i, int64_t Size)
+{
+	return (2.0 * i - (double)Size) / (double)Size;
+}
+
+// Gradient in lattice coordinates to world space, a, b and c are the lattice axes in world space
+static glm::vec3 LatticeToWorldGradient(const Vec3 &a, const Vec3 &b, const Vec3 &c, const glm::vec3 &Gradient)
+{
+	const Vec3 bc = b.cross(c), ca = c.cross(a), ab = a.cross(b);
+	return (glm::vec3)((bc * (double)Gradient.x + ca * (double)Gradient.y + ab * (double)Gradient.z) / a.dot(bc));
+}
 
-namespace std {
-template<typename T, typename U>
-struct hash<pair<T, U>>
+// The lowest point of every triangle overlapping a cell bounds the mesh over the cell from below, a sample takes the
+// lowest of the cells around it. The flat occluder triangles between the samples then stay below the mesh.
+static void BuildTileOccluder(const SChunkDesc &Chunk, SGenerationScratch &Scratch, double PlanetRadius, double Slack, STileOccluder &Occluder)
 {
-	size_t operator()(const pair<T, U> &p) const
+	const int Cells = STileOccluder::CELLS;
+	const std::vector<Vec3> &vPositions = Scratch.m_vVertexPositions;
+	const std::vector<unsigned int> &vIndices = Scratch.m_vIndices;
+	std::vector<glm::vec2> &vCoords = Scratch.m_vOccluderCoords;
+	Occluder.m_bValid = false;
+
+	// Unwarped face coordinates, the inverse of TileDirection
+	const int Axis = Chunk.m_Face / 2;
+	const double Sign = (Chunk.m_Face & 1) ? -1.0 : 1.0;
+	const double CellSize = std::ldexp(2.0, -Chunk.m_Level) / Cells;
+	vCoords.resize(vPositions.size());
+	for(size_t i = 0; i < vPositions.size(); ++i)
 	{
-		auto h1 = hash<T>{}(p.first);
-		auto h2 = hash<U>{}(p.second);
-		return h1 ^ (h2 << 1);
+		const double a[3] = {vPositions[i].x, vPositions[i].y, vPositions[i].z};
+		const double Major = a[Axis] * Sign;
+		const double tu = std::atan(a[(Axis + 1) % 3] / Major) * 4.0 / PI, tv = std::atan(a[(Axis + 2) % 3] / Major) * 4.0 / PI;
+		vCoords[i] = glm::vec2((float)((tu + 1.0) / CellSize - (double)(Chunk.m_aTile[0] * Cells)), (float)((tv + 1.0) / CellSize - (double)(Chunk.m_aTile[1] * Cells)));
+	}
+
+	float aCellMin[Cells * Cells];
+	std::fill(std::begin(aCellMin), std::end(aCellMin), FLT_MAX);
+	for(size_t t = 0; t + 2 < vIndices.size(); t += 3)
+	{
+		const unsigned int i0 = vIndices[t], i1 = vIndices[t + 1], i2 = vIndices[t + 2];
+		const Vec3 &a = vPositions[i0], &b = vPositions[i1], &c = vPositions[i2];
+		// Between its corners the triangle dips below them by at most the sagitta of its longest edge
+		const double MinRadius = std::min({a.length(), b.length(), c.length()});
+		const double LongestEdge = std::max({(b - a).length(), (c - b).length(), (a - c).length()});
+		const float Elevation = (float)(MinRadius - LongestEdge * LongestEdge / (2.0 * MinRadius) - Slack - PlanetRadius);
+
+		const glm::vec2 &ta = vCoords[i0], &tb = vCoords[i1], &tc = vCoords[i2];
+		const int x0 = std::clamp((int)std::floor(std::min({ta.x, tb.x, tc.x})), 0, Cells - 1), x1 = std::clamp((int)std::floor(std::max({ta.x, tb.x, tc.x})), 0, Cells - 1);
+		const int y0 = std::clamp((int)std::floor(std::min({ta.y, tb.y, tc.y})), 0, Cells - 1), y1 = std::clamp((int)std::floor(std::max({ta.y, tb.y, tc.y})), 0, Cells - 1);
+		for(int y = y0; y <= y1; ++y)
+			for(int x = x0; x <= x1; ++x)
+				aCellMin[y * Cells + x] = std::min(aCellMin[y * Cells + x], Elevation);
+	}
+
+	// A cell without triangles would leave the samples around it unbounded
+	for(float CellMin : aCellMin)
+		if(CellMin == FLT_MAX)
+			return;
+	for(int y = 0; y < STileOccluder::SAMPLES; ++y)
+	{
+		for(int x = 0; x < STileOccluder::SAMPLES; ++x)
+		{
+			float Lowest = FLT_MAX;
+			for(int cy = std::max(y - 1, 0); cy <= std::min(y, Cells - 1); ++cy)
+				for(int cx = std::max(x - 1, 0); cx <= std::min(x, Cells - 1); ++cx)
+					Lowest = std::min(Lowest, aCellMin[cy * Cells + cx]);
+			Occluder.m_aElevation[y * STileOccluder::SAMPLES + x] = Lowest;
+		}
 	}
-};
-} // namespace std
+	Occluder.m_bValid = true;
+}
+
+// =========================================================
+// CProceduralMesh Implementation
+// =========================================================
 
 CProceduralMesh::CProceduralMesh()
 {
 	m_bRunWorker = true;
+	m_StartTime = std::chrono::steady_clock::now();
 }
 
 CProceduralMesh::~CProceduralMesh()
@@ -126,7 +224,11 @@ void CProceduralMesh::Init(SBody *pBody, EBodyType bodyType, int voxelResolution
 	InitDebug();
 
 	if(m_BodyType == EBodyType::TERRESTRIAL)
+	{
 		m_TerrainGenerator.Init(pBody->m_Id + pBody->m_RenderParams.m_Seed, pBody->m_RenderParams.m_Terrain, pBody->m_RenderParams.m_TerrainType);
+		m_HeightCache.Init(&m_TerrainGenerator);
+	}
+	m_SampleCache.Init(&m_TerrainGenerator);
 
 	if(m_BodyType == EBodyType::TERRESTRIAL || m_BodyType == EBodyType::STAR || m_BodyType == EBodyType::GAS_GIANT)
 	{
@@ -136,8 +238,9 @@ void CProceduralMesh::Init(SBody *pBody, EBodyType bodyType, int voxelResolution
 			MaxDisplacementFactor = 0.0f;
 		float ScaleFactor = 1.0f + MaxDisplacementFactor * 1.2f;
 
-		double RootSize = m_pBody->m_RenderParams.m_Radius * 2.0 * (double)ScaleFactor;
-		m_pRootNode = std::make_shared<COctreeNode>(this, std::weak_ptr<COctreeNode>(), Vec3(0.0), RootSize, 0, voxelResolution);
+		m_RootSize = m_pBody->m_RenderParams.m_Radius * 2.0 * (double)ScaleFactor;
+		m_VoxelResolution = voxelResolution;
+		BuildTree();
 	}
 
 	unsigned int NumThreads = std::thread::hardware_concurrency();
@@ -222,7 +325,7 @@ void CProceduralMesh::InitDebug()
 
 void CProceduralMesh::RenderDebug(const CCamera &Camera)
 {
-	if(!m_bVisualizeOctree || !m_pRootNode)
+	if(!m_bVisualizeOctree || m_RootNode == NO_NODE)
 		return;
 
 	glDisable(GL_DEPTH_TEST);
@@ -235,17 +338,14 @@ void CProceduralMesh::RenderDebug(const CCamera &Camera)
 	glm::quat glmQ(q.w, q.x, q.y, q.z);
 	glm::mat4 rotationMat = glm::mat4_cast(glmQ);
 
-	std::function<void(COctreeNode *)> DrawNode = [&](COctreeNode *node) {
-		if(!node)
-			return;
-
-		if(/* node->m_bIsLeaf ||  */ node->m_VAO != 0)
+	std::function<void(const COctreeNode *)> DrawNode = [&](const COctreeNode *node) {
+		if(/* node->IsLeaf() ||  */ node->m_VAO != 0)
 		{
 			Vec3 PlanetToCam = m_pBody->m_SimParams.m_Position - Camera.m_AbsolutePosition;
-			Vec3 NodeCenterWorld = q.RotateVector(node->m_Center);
+			Vec3 NodeCenterWorld = q.RotateVector(node->m_BoundsCenter);
 			Vec3 NodeToCam = PlanetToCam + NodeCenterWorld;
 			glm::mat4 MatTranslate = glm::translate(glm::mat4(1.0f), (glm::vec3)NodeToCam);
-			glm::mat4 MatScale = glm::scale(glm::mat4(1.0f), glm::vec3(node->m_Size));
+			glm::mat4 MatScale = glm::scale(glm::mat4(1.0f), (glm::vec3)(node->m_BoundsHalfSize * 2.0));
 
 			glm::mat4 Model = MatTranslate * rotationMat * MatScale;
 
@@ -255,27 +355,373 @@ void CProceduralMesh::RenderDebug(const CCamera &Camera)
 			glDrawElements(GL_LINES, 24, GL_UNSIGNED_INT, 0);
 		}
 
-		if(!node->m_bIsLeaf)
+		if(!node->IsLeaf())
 		{
-			for(int i = 0; i < 8; ++i)
-				DrawNode(node->m_pChildren[i].get());
+			for(int i = 0; i < node->GetNumChildren(); ++i)
+				DrawNode(&node->GetChild(i));
 		}
 	};
 
-	DrawNode(m_pRootNode.get());
+	for(int i = 0; i < GetNumRoots(); ++i)
+		DrawNode(&GetNode(m_RootNode + i));
 	glBindVertexArray(0);
 
 	glEnable(GL_DEPTH_TEST);
 }
 
+void CProceduralMesh::BenchmarkMeshers()
+{
+	if(m_RootNode == NO_NODE)
+		return;
+
+	std::vector<SChunkDesc> vLeaves;
+	std::function<void(const COctreeNode &)> CollectLeaves = [&](const COctreeNode &Node) {
+		if(Node.IsLeaf())
+			vLeaves.push_back(Node.GetChunkDesc());
+		else
+			for(int i = 0; i < Node.GetNumChildren(); ++i)
+				CollectLeaves(Node.GetChild(i));
+	};
+	for(int i = 0; i < GetNumRoots(); ++i)
+		CollectLeaves(GetNode(m_RootNode + i));
+
+	// The live nodes and the workers are left alone, the caches are warmed by the first run
+	const EMesher aMeshers[] = {EMesher::MARCHING_CUBES, EMesher::SURFACE_NETS, EMesher::MARCHING_CUBES};
+	const char *apNames[] = {"Marching cubes", "Surface nets", "Marching cubes"};
+	SGenerationScratch Scratch;
+	for(int m = 0; m < 3; ++m)
+	{
+		size_t NumVertices = 0, NumTriangles = 0;
+		auto Start = std::chrono::high_resolution_clock::now();
+		for(SChunkDesc &Leaf : vLeaves)
+		{
+			SMeshData Mesh;
+			Leaf.m_Mesher = aMeshers[m];
+			GenerateMesh(Leaf, Scratch, Mesh);
+			NumVertices += Mesh.m_vVertices.size();
+			NumTriangles += (Mesh.m_vShortIndices.size() + Mesh.m_vIndices.size()) / 3;
+			RecycleMeshData(Mesh);
+		}
+		auto End = std::chrono::high_resolution_clock::now();
+		if(m == 0)
+			continue;
+		printf("%s: %zu chunks, %zu vertices, %zu triangles, %.1f ms\n", apNames[m], vLeaves.size(), NumVertices, NumTriangles,
+			std::chrono::duration<double, std::milli>(End - Start).count());
+	}
+}
+
+void CProceduralMesh::AcquireMeshData(SMeshData &Data)
+{
+	if(Data.m_vVertices.capacity() > 0)
+		return;
+
+	std::lock_guard<std::mutex> Lock(m_MeshDataPoolMutex);
+	if(!m_vMeshDataPool.empty())
+	{
+		// Only the storage, the rest is already filled in
+		SMeshData &Pooled = m_vMeshDataPool.back();
+		Data.m_vVertices.swap(Pooled.m_vVertices);
+		Data.m_vShortIndices.swap(Pooled.m_vShortIndices);
+		Data.m_vIndices.swap(Pooled.m_vIndices);
+		m_vMeshDataPool.pop_back();
+	}
+}
+
+void CProceduralMesh::RecycleMeshData(SMeshData &Data)
+{
+	Data.m_vVertices.clear();
+	Data.m_vShortIndices.clear();
+	Data.m_vIndices.clear();
+	if(Data.m_vVertices.capacity() == 0)
+		return;
+
+	std::lock_guard<std::mutex> Lock(m_MeshDataPoolMutex);
+	if(m_vMeshDataPool.size() < m_MaxApplyQueueSize)
+		m_vMeshDataPool.push_back(std::move(Data));
+	Data = SMeshData();
+}
+
+void CProceduralMesh::StoreCachedMesh(COctreeNode &Node)
+{
+	if(!m_bMeshCache || !Node.m_bGenerationAttempted || Node.m_bIsGenerating)
+		return;
+
+	SCachedMesh Entry;
+	Entry.m_Key = Node.GetMeshKey();
+	Entry.m_VAO = Node.m_VAO;
+	Entry.m_VBO = Node.m_VBO;
+	Entry.m_EBO = Node.m_EBO;
+	Entry.m_NumVertices = Node.m_NumVertices;
+	Entry.m_NumIndices = Node.m_NumIndices;
+	Entry.m_IndexType = Node.m_IndexType;
+	Entry.m_Mesh.m_Layout = Node.m_Layout;
+	Entry.m_Mesh.m_BoundsMin = Node.m_BoundsCenter - Node.m_BoundsHalfSize;
+	Entry.m_Mesh.m_BoundsMax = Node.m_BoundsCenter + Node.m_BoundsHalfSize;
+	Entry.m_Mesh.m_MinElevation = Node.m_aElevationRange[0];
+	Entry.m_Mesh.m_MaxElevation = Node.m_aElevationRange[1];
+	Entry.m_Mesh.m_Occluder = Node.m_Occluder;
+	Entry.m_Bytes = sizeof(SCachedMesh) + Node.m_NumVertices * sizeof(SPackedVertex) +
+			Node.m_NumIndices * (Node.m_IndexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int));
+	Node.m_VAO = 0;
+	Node.m_VBO = 0;
+	Node.m_EBO = 0;
+	Node.m_NumVertices = 0;
+	Node.m_NumIndices = 0;
+
+	// Left over from a tree the region was freed from before
+	auto Found = m_MeshCacheIndex.find(Entry.m_Key);
+	if(Found != m_MeshCacheIndex.end())
+		EraseCachedMesh(Found->second, true);
+
+	AccountCachedMesh(Entry, true);
+	m_MeshCache.push_front(std::move(Entry));
+	m_MeshCacheIndex[m_MeshCache.front().m_Key] = m_MeshCache.begin();
+}
+
+bool CProceduralMesh::RestoreCachedMesh(COctreeNode &Node)
+{
+	if(!m_bMeshCache)
+		return false;
+
+	auto Found = m_MeshCacheIndex.find(Node.GetMeshKey());
+	if(Found == m_MeshCacheIndex.end())
+	{
+		++m_MeshCacheMisses;
+		return false;
+	}
+	++m_MeshCacheHits;
+
+	SCachedMesh &Entry = *Found->second;
+	CancelMeshReadback(Entry);
+	if(Entry.m_VAO != 0 || Entry.m_Mesh.m_vVertices.empty())
+	{
+		// The buffers move over to the node, an empty mesh has none
+		Node.m_bGenerationAttempted = true;
+		Node.m_VAO = Entry.m_VAO;
+		Node.m_VBO = Entry.m_VBO;
+		Node.m_EBO = Entry.m_EBO;
+		Node.m_NumVertices = Entry.m_NumVertices;
+		Node.m_NumIndices = Entry.m_NumIndices;
+		Node.m_IndexType = Entry.m_IndexType;
+		Node.m_Layout = Entry.m_Mesh.m_Layout;
+		Node.m_Occluder = Entry.m_Mesh.m_Occluder;
+		if(Node.m_NumIndices > 0)
+			Node.SetMeshBounds(Entry.m_Mesh);
+	}
+	else
+		Node.ApplyMeshBuffers(Entry.m_Mesh);
+	EraseCachedMesh(Found->second, false);
+	return true;
+}
+
+void CProceduralMesh::TrimMeshCache()
+{
+	const size_t GPUBudget = m_bMeshCacheGPU ? (size_t)(m_MeshCacheGPUBudget * 1048576.0f) : 0;
+	const size_t CPUBudget = (size_t)(m_MeshCacheCPUBudget * 1048576.0f);
+
+	// Counting the meshes on their way to the CPU as gone already
+	size_t GPUBytes = m_MeshCacheGPUBytes;
+	for(auto It = m_MeshCache.rbegin(); It != m_MeshCache.rend() && m_NumMeshReadbacks > 0; ++It)
+	{
+		if(!It->m_ReadbackFence)
+			continue;
+		if(glClientWaitSync(It->m_ReadbackFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			GPUBytes -= It->m_Bytes;
+		else
+			FinishMeshReadback(*It);
+	}
+
+	// Both starting with the least recently stored meshes
+	for(auto It = m_MeshCache.rbegin(); It != m_MeshCache.rend() && GPUBytes > GPUBudget; ++It)
+	{
+		if(It->m_VAO == 0 || It->m_ReadbackFence)
+			continue;
+		StartMeshReadback(*It);
+		GPUBytes -= It->m_Bytes;
+	}
+
+	auto It = m_MeshCache.end();
+	while(m_MeshCacheCPUBytes > CPUBudget && It != m_MeshCache.begin())
+	{
+		--It;
+		if(It->m_VAO == 0)
+			It = EraseCachedMesh(It, true);
+	}
+}
+
+void CProceduralMesh::StartMeshReadback(SCachedMesh &Entry)
+{
+	const size_t VertexBytes = Entry.m_NumVertices * sizeof(SPackedVertex);
+	const size_t IndexBytes = Entry.m_NumIndices * (Entry.m_IndexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int));
+
+	glGenBuffers(1, &Entry.m_ReadbackBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, Entry.m_ReadbackBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, VertexBytes + IndexBytes, nullptr, GL_STREAM_READ);
+	glBindBuffer(GL_COPY_READ_BUFFER, Entry.m_VBO);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, VertexBytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, Entry.m_EBO);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, VertexBytes, IndexBytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	Entry.m_ReadbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	++m_NumMeshReadbacks;
+}
+
+void CProceduralMesh::FinishMeshReadback(SCachedMesh &Entry)
+{
+	AccountCachedMesh(Entry, false);
+	AcquireMeshData(Entry.m_Mesh);
+	const size_t VertexBytes = Entry.m_NumVertices * sizeof(SPackedVertex);
+	Entry.m_Mesh.m_vVertices.resize(Entry.m_NumVertices);
+	glBindBuffer(GL_COPY_READ_BUFFER, Entry.m_ReadbackBuffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, VertexBytes, Entry.m_Mesh.m_vVertices.data());
+	if(Entry.m_IndexType == GL_UNSIGNED_SHORT)
+	{
+		Entry.m_Mesh.m_vShortIndices.resize(Entry.m_NumIndices);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, VertexBytes, Entry.m_NumIndices * sizeof(uint16_t), Entry.m_Mesh.m_vShortIndices.data());
+	}
+	else
+	{
+		Entry.m_Mesh.m_vIndices.resize(Entry.m_NumIndices);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, VertexBytes, Entry.m_NumIndices * sizeof(unsigned int), Entry.m_Mesh.m_vIndices.data());
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	CancelMeshReadback(Entry);
+
+	glDeleteBuffers(1, &Entry.m_EBO);
+	glDeleteBuffers(1, &Entry.m_VBO);
+	glDeleteVertexArrays(1, &Entry.m_VAO);
+	Entry.m_VAO = 0;
+	Entry.m_VBO = 0;
+	Entry.m_EBO = 0;
+	AccountCachedMesh(Entry, true);
+}
+
+void CProceduralMesh::CancelMeshReadback(SCachedMesh &Entry)
+{
+	if(!Entry.m_ReadbackFence)
+		return;
+	glDeleteSync(Entry.m_ReadbackFence);
+	glDeleteBuffers(1, &Entry.m_ReadbackBuffer);
+	Entry.m_ReadbackFence = nullptr;
+	Entry.m_ReadbackBuffer = 0;
+	--m_NumMeshReadbacks;
+}
+
+void CProceduralMesh::ClearMeshCache()
+{
+	while(!m_MeshCache.empty())
+		EraseCachedMesh(m_MeshCache.begin(), true);
+}
+
+void CProceduralMesh::AccountCachedMesh(const SCachedMesh &Entry, bool bAdd)
+{
+	size_t &Bytes = Entry.m_VAO != 0 ? m_MeshCacheGPUBytes : m_MeshCacheCPUBytes;
+	Bytes = bAdd ? Bytes + Entry.m_Bytes : Bytes - Entry.m_Bytes;
+}
+
+std::list<CProceduralMesh::SCachedMesh>::iterator CProceduralMesh::EraseCachedMesh(std::list<SCachedMesh>::iterator It, bool bDeleteBuffers)
+{
+	AccountCachedMesh(*It, false);
+	CancelMeshReadback(*It);
+	if(bDeleteBuffers && It->m_VAO != 0)
+	{
+		glDeleteBuffers(1, &It->m_EBO);
+		glDeleteBuffers(1, &It->m_VBO);
+		glDeleteVertexArrays(1, &It->m_VAO);
+	}
+	RecycleMeshData(It->m_Mesh);
+	m_MeshCacheIndex.erase(It->m_Key);
+	return m_MeshCache.erase(It);
+}
+
 void CProceduralMesh::Update(CCamera &Camera)
 {
 	CheckApplyQueue();
 
+	// Cached meshes made with other settings would not match their new neighbours
+	const int MeshSignature = GetMeshSignature();
+	if(!m_bMeshCache || MeshSignature != m_MeshCacheSignature)
+		ClearMeshCache();
+	m_MeshCacheSignature = MeshSignature;
+
 	CalculateFrustum(Camera);
 
-	if(m_pRootNode)
-		m_pRootNode->Update(Camera);
+	auto Now = std::chrono::steady_clock::now();
+	m_Time = std::chrono::duration<double>(Now - m_StartTime).count();
+	m_LodDeadline = Now + std::chrono::microseconds((int64_t)(m_LodBudget * 1000.0f));
+	m_NumLodEvaluations = 0;
+
+	// Accumulate the camera motion in the body frame
+	if(m_pBody)
+	{
+		const Quat q = m_pBody->m_SimParams.m_Orientation;
+		const Vec3 CamPos = q.Conjugate().RotateVector(Camera.m_AbsolutePosition - m_pBody->m_SimParams.m_Position);
+		const glm::mat3 View(Camera.m_View);
+		glm::mat3 ViewRotation;
+		ViewRotation[0] = View * (glm::vec3)q.RotateVector(Vec3(1.0, 0.0, 0.0));
+		ViewRotation[1] = View * (glm::vec3)q.RotateVector(Vec3(0.0, 1.0, 0.0));
+		ViewRotation[2] = View * (glm::vec3)q.RotateVector(Vec3(0.0, 0.0, 1.0));
+
+		const bool bFocused = m_pBody == Camera.m_pFocusedBody;
+		const bool bContinuous = m_bLodStateValid && bFocused == m_bLodFocused && Camera.m_Projection == m_LodProjection && m_SplitMultiplier == m_LodSplitMultiplier && m_MergeMultiplier == m_LodMergeMultiplier;
+
+		// Smoothed over about a quarter of a second, a single frame is too noisy to extrapolate
+		const double Dt = m_Time - m_LodUpdateTime;
+		if(!bContinuous)
+			m_LodCamVelocity = Vec3(0.0);
+		else if(Dt > 0.0)
+			m_LodCamVelocity += ((CamPos - m_LodCamPos) / Dt - m_LodCamVelocity) * (1.0 - std::exp(-Dt / 0.25));
+
+		// A look-ahead that small against the altitude would not change any decision
+		const Vec3 LookAhead = m_LodCamVelocity * (double)m_PrefetchTime;
+		m_bPrefetchActive = m_bPrefetch && LookAhead.length() > 0.01 * (CamPos.length() - m_pBody->m_RenderParams.m_Radius);
+		const Vec3 PrefetchCamPos = m_bPrefetchActive ? CamPos + LookAhead : CamPos;
+
+		if(bContinuous)
+		{
+			// The merge decisions also depend on the extrapolated position
+			m_LodTravel += std::max((CamPos - m_LodCamPos).length(), (PrefetchCamPos - m_PrefetchCamPos).length());
+			float Turn = 0.0f;
+			for(int i = 0; i < 3; ++i)
+				Turn += glm::length2(ViewRotation[i] - m_LodViewRotation[i]);
+			m_LodTurn += std::sqrt(Turn);
+		}
+		else
+			++m_LodEpoch;
+
+		m_LodCamPos = CamPos;
+		m_PrefetchCamPos = PrefetchCamPos;
+		m_LodViewRotation = ViewRotation;
+		m_LodProjection = Camera.m_Projection;
+		m_bLodFocused = bFocused;
+		m_LodSplitMultiplier = m_SplitMultiplier;
+		m_LodMergeMultiplier = m_MergeMultiplier;
+		m_bLodStateValid = true;
+		m_LodUpdateTime = m_Time;
+	}
+
+	if(m_RootNode == NO_NODE)
+		return;
+	if((m_bCubeSphere && m_BodyType == EBodyType::TERRESTRIAL) != m_bTreeIsCubeSphere)
+		BuildTree();
+
+	double MinElevation, MaxElevation;
+	m_TerrainGenerator.GetElevationRange(m_pBody->m_RenderParams.m_Radius, MinElevation, MaxElevation);
+	m_OccluderRadius = m_pBody->m_RenderParams.m_Radius + MinElevation;
+
+	for(int i = 0; i < GetNumRoots(); ++i)
+		GetNode(m_RootNode + i).Update(Camera);
+
+	// With what is left of the budget
+	if(m_bPrefetchActive)
+	{
+		for(int i = 0; i < GetNumRoots(); ++i)
+			GetNode(m_RootNode + i).Prefetch();
+	}
+
+	RefreshGenerationQueue();
+	TrimMeshCache();
 }
 
 void CProceduralMesh::Render(const CCamera &Camera, const SBody *pLightBody, bool bIsShadowPass, double Time)
@@ -334,7 +780,7 @@ void CProceduralMesh::Render(const CCamera &Camera, const SBody *pLightBody, boo
 		return;
 	}
 
-	if(!m_pRootNode)
+	if(m_RootNode == NO_NODE)
 		return;
 
 	m_Shader.Use();
@@ -389,8 +835,40 @@ void CProceduralMesh::Render(const CCamera &Camera, const SBody *pLightBody, boo
 	m_Shader.SetVec3("uRock", m_pBody->m_RenderParams.m_Colors.m_Rock);
 	m_Shader.SetVec3("uTundra", m_pBody->m_RenderParams.m_Colors.m_Tundra);
 
-	if(m_pRootNode)
-		m_pRootNode->Render(m_Shader, Camera.m_AbsolutePosition, m_pBody->m_SimParams.m_Position, m_pBody->m_SimParams.m_Orientation);
+	m_bOcclusionActive = false;
+	m_NumOccludedNodes = 0;
+	m_NumDrawnMeshes = 0;
+	if(!bIsShadowPass)
+		UpdateOcclusion(Camera);
+
+	for(int i = 0; i < GetNumRoots(); ++i)
+		GetNode(m_RootNode + i).Render(m_Shader, Camera.m_AbsolutePosition, m_pBody->m_SimParams.m_Position, m_pBody->m_SimParams.m_Orientation, !bIsShadowPass);
+}
+
+void CProceduralMesh::UpdateOcclusion(const CCamera &Camera)
+{
+	m_NumOccluders = 0;
+	if(!m_bOcclusionCulling || !m_bTreeIsCubeSphere)
+		return;
+	auto Start = std::chrono::steady_clock::now();
+
+	// Only the nearest ones, the farther ones cover little of the screen
+	m_vOccluderCandidates.clear();
+	for(int i = 0; i < GetNumRoots(); ++i)
+		GetNode(m_RootNode + i).CollectOccluders(m_vOccluderCandidates);
+	if((int)m_vOccluderCandidates.size() > m_MaxOccluders)
+	{
+		std::nth_element(m_vOccluderCandidates.begin(), m_vOccluderCandidates.begin() + m_MaxOccluders, m_vOccluderCandidates.end());
+		m_vOccluderCandidates.resize(m_MaxOccluders);
+	}
+
+	m_OcclusionBuffer.Clear(m_OcclusionWidth, Camera.m_View, Camera.m_Projection);
+	for(const auto &Candidate : m_vOccluderCandidates)
+		GetNode(Candidate.second).DrawOccluder(m_OcclusionBuffer);
+	m_OcclusionBuffer.Finish();
+	m_NumOccluders = (int)m_vOccluderCandidates.size();
+	m_bOcclusionActive = m_NumOccluders > 0;
+	m_OcclusionTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - Start).count();
 }
 
 void CProceduralMesh::Destroy()
@@ -405,7 +883,15 @@ void CProceduralMesh::Destroy()
 			thread.join();
 	}
 
-	m_pRootNode = nullptr;
+	for(uint32_t i = 0; i < m_NumNodes; ++i)
+		GetNode(i).Release();
+	ClearMeshCache();
+	m_vpNodePages.clear();
+	m_avFreeBlocks[0].clear();
+	m_avFreeBlocks[1].clear();
+	m_NumNodes = 0;
+	m_NumLiveNodes = 0;
+	m_RootNode = NO_NODE;
 	m_Shader.Destroy();
 	m_DebugShader.Destroy();
 	if(m_DebugCubeVAO)
@@ -416,60 +902,187 @@ void CProceduralMesh::Destroy()
 		glDeleteBuffers(1, &m_DebugCubeEBO);
 }
 
-void CProceduralMesh::AddToGenerationQueue(std::shared_ptr<COctreeNode> pNode, double distToCam)
+uint32_t CProceduralMesh::AllocateBlock(uint32_t Size)
+{
+	m_NumLiveNodes += Size;
+	std::vector<uint32_t> &vFreeBlocks = m_avFreeBlocks[Size == 8 ? 1 : 0];
+	if(!vFreeBlocks.empty())
+	{
+		uint32_t First = vFreeBlocks.back();
+		vFreeBlocks.pop_back();
+		return First;
+	}
+
+	// A block never straddles two pages
+	if(m_NumNodes % NODE_PAGE_SIZE + Size > NODE_PAGE_SIZE)
+		m_NumNodes += NODE_PAGE_SIZE - m_NumNodes % NODE_PAGE_SIZE;
+	if(m_NumNodes % NODE_PAGE_SIZE == 0)
+		m_vpNodePages.push_back(std::make_unique<COctreeNode[]>(NODE_PAGE_SIZE));
+	uint32_t First = m_NumNodes;
+	m_NumNodes += Size;
+	return First;
+}
+
+void CProceduralMesh::FreeBlock(uint32_t First, uint32_t Size)
+{
+	for(uint32_t i = First; i < First + Size; ++i)
+	{
+		COctreeNode &Node = GetNode(i);
+		if(!Node.IsLeaf())
+			FreeBlock(Node.m_FirstChild, Node.GetNumChildren());
+		Node.Release();
+	}
+	m_avFreeBlocks[Size == 8 ? 1 : 0].push_back(First);
+	m_NumLiveNodes -= Size;
+}
+
+void CProceduralMesh::BuildTree()
+{
+	if(m_RootNode != NO_NODE)
+		FreeBlock(m_RootNode, 8);
+
+	// Both start with a block of their own, the six face roots share theirs
+	m_bTreeIsCubeSphere = m_bCubeSphere && m_BodyType == EBodyType::TERRESTRIAL;
+	m_RootNode = AllocateBlock(8);
+	if(m_bTreeIsCubeSphere)
+	{
+		double MinElevation, MaxElevation;
+		m_TerrainGenerator.GetElevationRange(m_pBody->m_RenderParams.m_Radius, MinElevation, MaxElevation);
+		for(int Face = 0; Face < 6; ++Face)
+			GetNode(m_RootNode + Face).InitTile(this, m_RootNode + Face, NO_NODE, Face, 0, 0, 0, m_VoxelResolution, MinElevation, MaxElevation);
+	}
+	else
+		GetNode(m_RootNode).Init(this, m_RootNode, NO_NODE, Vec3(0.0), m_RootSize, 0, m_VoxelResolution);
+}
+
+bool CProceduralMesh::IsAlive(const SNodeHandle &Handle) const
+{
+	return Handle.m_Index < m_NumNodes && GetNode(Handle.m_Index).m_Generation == Handle.m_Generation;
+}
+
+void CProceduralMesh::AddToGenerationQueue(uint32_t Node, double distToCam, bool bPrefetch)
 {
+	COctreeNode &Target = GetNode(Node);
+	Target.m_pGenerationCancel = std::make_shared<std::atomic<bool>>(false);
 	{
 		std::lock_guard<std::mutex> lock(m_GenQueueMutex);
-		m_GenerationQueue.push({pNode, distToCam});
+		m_vGenerationQueue.push_back({Target.GetHandle(), Target.GetChunkDesc(), distToCam, bPrefetch, Target.m_pGenerationCancel});
+		std::push_heap(m_vGenerationQueue.begin(), m_vGenerationQueue.end());
 	}
 	m_GenQueueCV.notify_one();
 }
 
+void CProceduralMesh::RefreshGenerationQueue()
+{
+	std::lock_guard<std::mutex> lock(m_GenQueueMutex);
+	auto End = std::remove_if(m_vGenerationQueue.begin(), m_vGenerationQueue.end(), [this](const SGenTask &Task) {
+		// Released nodes have set the token already
+		if(Task.m_pCancel->load() || !IsAlive(Task.m_Node))
+			return true;
+
+		// Prefetches are made for where the camera will be, so only regular tasks go with the culling
+		COctreeNode &Node = GetNode(Task.m_Node.m_Index);
+		if(Node.m_bLodCulled && !Node.m_bPrefetched && !Node.m_bBalanceRequest)
+		{
+			Node.CancelGeneration();
+			return true;
+		}
+		return false;
+	});
+	m_NumDroppedTasks += (int)(m_vGenerationQueue.end() - End);
+	m_vGenerationQueue.erase(End, m_vGenerationQueue.end());
+
+	for(SGenTask &Task : m_vGenerationQueue)
+	{
+		const COctreeNode &Node = GetNode(Task.m_Node.m_Index);
+		Task.m_bPrefetch = Node.m_bPrefetched;
+		// Merge fallbacks stay first, nothing is drawn for their node until they are done
+		if(Task.m_Priority > 0.0)
+		{
+			const Vec3 &CamPos = Task.m_bPrefetch ? m_PrefetchCamPos : m_LodCamPos;
+			Task.m_Priority = std::max(0.1, GetDistanceToBox(CamPos, Node.m_BoundsCenter, Node.m_BoundsHalfSize));
+		}
+	}
+	std::make_heap(m_vGenerationQueue.begin(), m_vGenerationQueue.end());
+}
+
 void CProceduralMesh::CheckApplyQueue()
 {
-	std::shared_ptr<COctreeNode> pNode = nullptr;
 	while(true)
 	{
-		std::lock_guard<std::mutex> lock(m_ApplyQueueMutex);
-		if(m_ApplyQueue.empty())
-			break;
-		pNode = m_ApplyQueue.front();
-		m_ApplyQueue.pop();
+		SGenResult Result;
+		{
+			std::lock_guard<std::mutex> lock(m_ApplyQueueMutex);
+			if(m_ApplyQueue.empty())
+				break;
+			Result = std::move(m_ApplyQueue.front());
+			m_ApplyQueue.pop();
+		}
+		m_ApplyQueueCV.notify_one();
 
-		if(pNode)
+		// The node may have been merged away or lost interest while its mesh was generated
+		if(IsAlive(Result.m_Node) && !Result.m_pCancel->load())
+			GetNode(Result.m_Node.m_Index).ApplyMeshBuffers(Result.m_Mesh);
+		else
 		{
-			pNode->ApplyMeshBuffers();
-			m_ApplyQueueCV.notify_one();
+			++m_NumDiscardedMeshes;
+			m_WastedMicroseconds += Result.m_Microseconds;
 		}
+		RecycleMeshData(Result.m_Mesh);
 	}
 }
 
 void CProceduralMesh::GenerationWorkerLoop()
 {
+	// Grows to the largest chunk seen, after that generating does not allocate
+	SGenerationScratch Scratch;
+
 	while(m_bRunWorker)
 	{
-		std::shared_ptr<COctreeNode> pNode = nullptr;
+		SGenTask Task;
+		bool bHasTask = false;
 
 		{
 			std::unique_lock<std::mutex> lock(m_GenQueueMutex);
 			m_GenQueueCV.wait(lock, [this] {
-				return !m_GenerationQueue.empty() || !m_bRunWorker;
+				return !m_vGenerationQueue.empty() || !m_bRunWorker;
 			});
 
 			if(!m_bRunWorker)
 				break;
 
-			if(!m_GenerationQueue.empty())
+			if(!m_vGenerationQueue.empty())
 			{
 				// Get highest priority (shortest distance)
-				pNode = m_GenerationQueue.top().m_pNode;
-				m_GenerationQueue.pop();
+				std::pop_heap(m_vGenerationQueue.begin(), m_vGenerationQueue.end());
+				Task = m_vGenerationQueue.back();
+				m_vGenerationQueue.pop_back();
+				bHasTask = true;
 			}
 		}
 
-		if(pNode)
+		if(bHasTask)
 		{
-			pNode->GenerateMesh();
+			// Cancelled after the last refresh of the queue
+			if(Task.m_pCancel->load())
+			{
+				++m_NumDroppedTasks;
+				continue;
+			}
+
+			SGenResult Result;
+			Result.m_Node = Task.m_Node;
+			Result.m_pCancel = Task.m_pCancel;
+			const auto Start = std::chrono::steady_clock::now();
+			const bool bDone = GenerateMesh(Task.m_Chunk, Scratch, Result.m_Mesh, Task.m_pCancel.get());
+			Result.m_Microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count();
+			if(!bDone)
+			{
+				++m_NumAbortedTasks;
+				m_WastedMicroseconds += Result.m_Microseconds;
+				RecycleMeshData(Result.m_Mesh);
+				continue;
+			}
 
 			{
 				std::unique_lock<std::mutex> lock(m_ApplyQueueMutex);
@@ -481,71 +1094,240 @@ void CProceduralMesh::GenerationWorkerLoop()
 				if(!m_bRunWorker)
 					break;
 
-				m_ApplyQueue.push(pNode);
+				m_ApplyQueue.push(std::move(Result));
 			}
 		}
 	}
 }
 
-COctreeNode::COctreeNode(CProceduralMesh *pOwnerMesh, std::weak_ptr<COctreeNode> pParent, Vec3 center, double size, int level, int voxelResolution) :
-	m_pOwnerMesh(pOwnerMesh),
-	m_pParent(pParent),
-	m_Level(level),
-	m_VoxelResolution(voxelResolution),
-	m_Center(center),
-	m_Size(size),
-	m_bIsGenerating(false),
-	m_bHasGeneratedData(false),
-	m_bGenerationAttempted(false)
+bool CProceduralMesh::CanContainSurface(const Vec3 &BoxMin, double BoxSize, double PlanetRadius, double Footprint)
 {
-}
+	CTerrainGenerator &Generator = m_TerrainGenerator;
+	const Vec3 BoxMax = BoxMin + Vec3(BoxSize);
+
+	// Radial extent of the box against the shell the surface can be in
+	Vec3 Closest(std::clamp(0.0, BoxMin.x, BoxMax.x), std::clamp(0.0, BoxMin.y, BoxMax.y), std::clamp(0.0, BoxMin.z, BoxMax.z));
+	Vec3 Farthest(std::max(std::abs(BoxMin.x), std::abs(BoxMax.x)), std::max(std::abs(BoxMin.y), std::abs(BoxMax.y)), std::max(std::abs(BoxMin.z), std::abs(BoxMax.z)));
+	double MinDist = Closest.length();
+	double MaxDist = Farthest.length();
+
+	double MinElevation, MaxElevation;
+	Generator.GetElevationRange(PlanetRadius, MinElevation, MaxElevation);
+	if(MinDist > PlanetRadius + MaxElevation || MaxDist < PlanetRadius + MinElevation)
+		return false;
+	if(MinDist <= 0.0)
+		return true;
 
-COctreeNode::~COctreeNode()
-{
-	if(m_VAO != 0)
+	// Borderline boxes: a coarse sample keeps its sign over its whole cell if it is further
+	// from zero than the density can change within half the cell diagonal
+	const int Coarse = 4;
+	const double CellSize = BoxSize / Coarse;
+	const double Lipschitz = 1.0 + Generator.GetElevationSlopeBound(PlanetRadius) / MinDist;
+	const double Required = Lipschitz * CellSize * std::sqrt(3.0) * 0.5;
+
+	Vec3 aPositions[Coarse * Coarse * Coarse];
+	float aDensities[Coarse * Coarse * Coarse];
+	for(int z = 0; z < Coarse; ++z)
+		for(int y = 0; y < Coarse; ++y)
+			for(int x = 0; x < Coarse; ++x)
+				aPositions[x + (y + z * Coarse) * Coarse] = BoxMin + Vec3((x + 0.5) * CellSize, (y + 0.5) * CellSize, (z + 0.5) * CellSize);
+	Generator.GetDensities(aPositions, Coarse * Coarse * Coarse, PlanetRadius, aDensities, nullptr, Footprint);
+
+	const bool bSolid = aDensities[0] > 0.0f;
+	for(float Density : aDensities)
 	{
-		glDeleteBuffers(1, &m_EBO);
-		glDeleteBuffers(1, &m_VBO);
-		glDeleteVertexArrays(1, &m_VAO);
-		m_VAO = 0;
-		m_VBO = 0;
-		m_EBO = 0;
-		m_NumIndices = 0;
+		if((Density > 0.0f) != bSolid || std::abs((double)Density) < Required)
+			return true;
 	}
+	return false;
 }
 
-void COctreeNode::GenerateMesh()
+bool CProceduralMesh::GenerateMesh(const SChunkDesc &Chunk, SGenerationScratch &Scratch, SMeshData &Mesh, const std::atomic<bool> *pCancel)
 {
-	const int res = m_VoxelResolution;
-	const int Padding = 1;
+	const int res = Chunk.m_VoxelResolution;
+	const int Padding = GRID_PADDING;
 	const int PaddedRes = res + Padding * 2;
 	const int PaddedRes1 = PaddedRes + 1;
-	const int NumGridPoints = PaddedRes1 * PaddedRes1 * PaddedRes1;
+	const int SliceSize = PaddedRes1 * PaddedRes1;
+	const bool bTile = Chunk.m_Face >= 0;
 
-	std::vector<STerrainOutput> vTerrainGrid(NumGridPoints);
-
-	double StepSize = m_Size / (double)res;
-	Vec3 StartCorner = m_Center - Vec3(m_Size * 0.5);
+	double StepSize = Chunk.m_Size / (double)res;
+	Vec3 StartCorner = Chunk.m_Center - Vec3(Chunk.m_Size * 0.5);
 	Vec3 SamplingStartCorner = StartCorner - Vec3((double)Padding * StepSize);
 
-	double radius = m_pOwnerMesh->m_pBody->m_RenderParams.m_Radius;
+	double radius = m_pBody->m_RenderParams.m_Radius;
+
+	// Octaves finer than the voxels would only alias
+	const double Footprint = Chunk.m_bOctaveCulling ? StepSize : 0.0;
+
+	std::vector<SProceduralVertex> &vVertices = Scratch.m_vVertices;
+	std::vector<unsigned int> &vIndices = Scratch.m_vIndices;
+	vVertices.clear();
+	vIndices.clear();
+	Mesh.m_vVertices.clear();
+	Mesh.m_vShortIndices.clear();
+	Mesh.m_vIndices.clear();
+	Mesh.m_Layout = SMeshLayout();
+
+	// Checked between the stages
+	auto IsCancelled = [pCancel]() { return pCancel && pCancel->load(std::memory_order_relaxed); };
+
+	auto SampleDensities = [&](const Vec3 *pPositions, int Count, double SampleStep, double SampleFootprint, float *pDensities) {
+		if(Chunk.m_bHeightCache && m_BodyType == EBodyType::TERRESTRIAL)
+			m_HeightCache.GetDensities(pPositions, Count, SampleStep, radius, pDensities, SampleFootprint);
+		else
+			m_TerrainGenerator.GetDensities(pPositions, Count, radius, pDensities, nullptr, SampleFootprint);
+	};
 
-	for(int z = 0; z <= PaddedRes; ++z)
+	// Cells per axis. A tile is a lattice of res x res columns on its cube face, warped onto the sphere, with as many
+	// layers of StepSize as the surface inside it spans. The lattice of the next level is exactly twice as fine, so grid
+	// points on a border shared with a neighbour, also across a cube edge, are bitwise the same in both.
+	int aRes[3] = {res, res, res};
+	int64_t aLatticeStart[3] = {0, 0, 0}; // tiles, lattice coordinates of the first interior grid point
+	int64_t LatticeSize = 0; // tiles, columns across the face
+
+	// The grid only classifies cells, the biome attributes are evaluated at the emitted vertices below
+	std::vector<float> &vDensityGrid = Scratch.m_vDensityGrid;
+	std::vector<Vec3> &vColumns = Scratch.m_vColumnDirections;
+	if(bTile)
 	{
-		for(int y = 0; y <= PaddedRes; ++y)
-		{
-			for(int x = 0; x <= PaddedRes; ++x)
+		LatticeSize = (int64_t)res << Chunk.m_Level;
+		aLatticeStart[0] = Chunk.m_aTile[0] * res;
+		aLatticeStart[1] = Chunk.m_aTile[1] * res;
+		vColumns.resize(SliceSize);
+		for(int y = 0; y < PaddedRes1; ++y)
+			for(int x = 0; x < PaddedRes1; ++x)
+				vColumns[x + y * PaddedRes1] = TileDirection(Chunk.m_Face, LatticeCoordinate((double)(aLatticeStart[0] - Padding + x), LatticeSize),
+					LatticeCoordinate((double)(aLatticeStart[1] - Padding + y), LatticeSize));
+
+		// In batches on the stack, like CHeightCache::SampleDensityGrid
+		auto SampleTile = [&](int Count, auto &&Position, float *pDensities) {
+			const int BatchSize = 256;
+			Vec3 aPositions[BatchSize];
+			for(int First = 0; First < Count; First += BatchSize)
 			{
-				Vec3 WorldPos = SamplingStartCorner + Vec3((double)x * StepSize, (double)y * StepSize, (double)z * StepSize);
-				int Idx = x + y * PaddedRes1 + z * PaddedRes1 * PaddedRes1;
-				vTerrainGrid[Idx] = m_pOwnerMesh->m_TerrainGenerator.GetTerrainOutput(WorldPos, radius);
+				const int Num = std::min(BatchSize, Count - First);
+				for(int n = 0; n < Num; ++n)
+					aPositions[n] = Position(First + n);
+				SampleDensities(aPositions, Num, StepSize, Footprint, pDensities + First);
 			}
+		};
+
+		// The density at the planet radius is the elevation of the column, the surface lies in the layers between
+		// the lowest and the highest one plus a spare layer on each side
+		std::vector<float> &vHeights = Scratch.m_vColumnHeights;
+		vHeights.resize(SliceSize);
+		SampleTile(SliceSize, [&](int n) { return vColumns[n] * radius; }, vHeights.data());
+		const auto MinMax = std::minmax_element(vHeights.begin(), vHeights.end());
+		aLatticeStart[2] = (int64_t)std::floor(*MinMax.first / StepSize) - 1;
+		aRes[2] = (int)((int64_t)std::floor(*MinMax.second / StepSize) + 2 - aLatticeStart[2]);
+
+		const int NumGridPoints = SliceSize * (aRes[2] + Padding * 2 + 1);
+		vDensityGrid.resize(NumGridPoints);
+		SampleTile(NumGridPoints, [&](int n) { return vColumns[n % SliceSize] * (radius + (double)(aLatticeStart[2] - Padding + n / SliceSize) * StepSize); }, vDensityGrid.data());
+	}
+	else
+	{
+		if(!CanContainSurface(SamplingStartCorner, StepSize * PaddedRes, radius, Footprint))
+			return true;
+
+		vDensityGrid.resize(SliceSize * PaddedRes1);
+		if(Chunk.m_bHeightCache && m_BodyType == EBodyType::TERRESTRIAL)
+			m_HeightCache.SampleDensityGrid(SamplingStartCorner, StepSize, PaddedRes1, radius, vDensityGrid.data(), Footprint);
+		else if(Chunk.m_bSampleCache)
+		{
+			// The root is centered at the origin and every level halves the size exactly
+			const double RootSize = std::ldexp(Chunk.m_Size, Chunk.m_Level);
+			const Vec3 LatticeStart = (StartCorner + Vec3(RootSize * 0.5)) / StepSize;
+			const int64_t aStart[3] = {std::llround(LatticeStart.x) - Padding, std::llround(LatticeStart.y) - Padding, std::llround(LatticeStart.z) - Padding};
+			m_SampleCache.SampleDensityGrid(SamplingStartCorner, aStart, Chunk.m_Level, StepSize, PaddedRes1, radius, vDensityGrid.data(), Footprint);
 		}
+		else
+			m_TerrainGenerator.SampleDensityGrid(SamplingStartCorner, StepSize, PaddedRes1, radius, vDensityGrid.data(), Footprint);
+	}
+	if(IsCancelled())
+		return false;
+
+	std::vector<Vec3> &vVertexPositions = Scratch.m_vVertexPositions;
+	std::vector<float> &vVertexElevations = Scratch.m_vVertexElevations;
+	vVertexPositions.clear();
+	vVertexElevations.clear();
+
+	// The tile lattice is left-handed on the negative cube faces
+	const bool bFlipWinding = bTile && (Chunk.m_Face & 1);
+
+	// Vertex of every cell edge crossing the surface, addressed by the grid point at the lower end of the edge.
+	// x and y edges are kept for the bottom and the top plane of the current layer of cells, z edges for the layer itself.
+	const unsigned int NoVertex = ~0u;
+	std::vector<unsigned int>(&avXEdges)[2] = Scratch.m_avXEdges, (&avYEdges)[2] = Scratch.m_avYEdges, &vZEdges = Scratch.m_vZEdges;
+	vZEdges.assign(SliceSize, NoVertex);
+	for(int Plane = 0; Plane < 2; ++Plane)
+	{
+		avXEdges[Plane].assign(SliceSize, NoVertex);
+		avYEdges[Plane].assign(SliceSize, NoVertex);
+	}
+
+	// Vertices on the edges in the chunk faces stay addressable for the transitions, per face the edges along u then along v
+	int aFaceGridSize[6];
+	std::vector<unsigned int>(&avFaceEdges)[6] = Scratch.m_avFaceEdges;
+	for(int Face = 0; Face < 6; ++Face)
+	{
+		const int Axis = Face / 2;
+		aFaceGridSize[Face] = (aRes[(Axis + 1) % 3] + 1) * (aRes[(Axis + 2) % 3] + 1);
+		avFaceEdges[Face].assign(aFaceGridSize[Face] * 2, NoVertex);
 	}
 
-	m_vGeneratedVertices.clear();
-	m_vGeneratedIndices.clear();
-	std::unordered_map<std::pair<int, int>, unsigned int> mVertexMap;
+	auto GridPosition = [&](int Idx) -> Vec3 {
+		const int gx = Idx % PaddedRes1, gy = (Idx / PaddedRes1) % PaddedRes1, gz = Idx / SliceSize;
+		if(bTile)
+			return vColumns[Idx % SliceSize] * (radius + (double)(aLatticeStart[2] - Padding + gz) * StepSize);
+		return SamplingStartCorner + Vec3((double)gx * StepSize, (double)gy * StepSize, (double)gz * StepSize);
+	};
+
+	// Central differences on the padded grid, every corner of a cell inside the padding has both neighbours
+	auto GridGradient = [&](int Idx) -> glm::vec3 {
+		const glm::vec3 Gradient(
+			vDensityGrid[Idx + 1] - vDensityGrid[Idx - 1],
+			vDensityGrid[Idx + PaddedRes1] - vDensityGrid[Idx - PaddedRes1],
+			vDensityGrid[Idx + SliceSize] - vDensityGrid[Idx - SliceSize]);
+		if(!bTile)
+			return Gradient;
+		return LatticeToWorldGradient(GridPosition(Idx + 1) - GridPosition(Idx - 1), GridPosition(Idx + PaddedRes1) - GridPosition(Idx - PaddedRes1),
+			GridPosition(Idx + SliceSize) - GridPosition(Idx - SliceSize), Gradient);
+	};
+
+	// The density is the planet radius minus the distance from the center plus the elevation, so the density
+	// interpolated at the vertex gives its elevation without sampling the terrain again
+	auto EmitVertex = [&](const Vec3 &PosDouble, float Density, const glm::vec3 &Gradient) -> unsigned int {
+		glm::vec3 Norm;
+		if(Chunk.m_bGridNormals)
+		{
+			float Length = glm::length(Gradient);
+			Norm = Length > 0.0f ? -Gradient / Length : (glm::vec3)PosDouble.normalize();
+		}
+		else
+			Norm = m_TerrainGenerator.CalculateDensityGradient(PosDouble, radius);
+
+		SProceduralVertex vert;
+		Vec3 localPos = PosDouble - Chunk.m_Center;
+		vert.position = (glm::vec3)localPos;
+		vert.normal = Norm;
+
+		vVertices.push_back(vert);
+		vVertexPositions.push_back(PosDouble);
+		vVertexElevations.push_back((float)(PosDouble.length() - radius) + Density);
+		return vVertices.size() - 1;
+	};
+
+	// Always interpolates from the lower to the upper grid point, so every cell sharing the edge would get the same vertex
+	auto EmitEdgeVertex = [&](int c1_global, int c2_global) -> unsigned int {
+		float d1 = vDensityGrid[c1_global];
+		float d2 = vDensityGrid[c2_global];
+		float t = (glm::abs(d1 - d2) > 0.00001f) ? (0.0f - d1) / (d2 - d1) : 0.5f;
+
+		Vec3 PosDouble = GridPosition(c1_global) * (1.0 - (double)t) + GridPosition(c2_global) * (double)t;
+		return EmitVertex(PosDouble, 0.0f, glm::mix(GridGradient(c1_global), GridGradient(c2_global), t));
+	};
 
 	const int aaCornerOffsets[8][3] = {
 		{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
@@ -556,30 +1338,147 @@ void COctreeNode::GenerateMesh()
 		{4, 5}, {5, 6}, {6, 7}, {7, 4},
 		{0, 4}, {1, 5}, {2, 6}, {3, 7}};
 
-	for(int z = Padding; z < Padding + res; ++z)
+	if(Chunk.m_Mesher == EMesher::SURFACE_NETS)
 	{
-		for(int y = Padding; y < Padding + res; ++y)
-		{
-			for(int x = Padding; x < Padding + res; ++x)
-			{
-				Vec3 Corners[8];
-				float Densities[8];
-				int CornerGlobalIndices[8];
-				int CubeIndex = 0;
+		// One vertex per cell at the mean of its edge crossings, one quad per grid edge crossing the surface.
+		// The node owns the edges starting inside it, so the quads along the lower faces reach into the padding cells
+		// and meet the quads of a same-level neighbour exactly.
+		const int CellSliceSize = PaddedRes * PaddedRes;
+		std::vector<unsigned int> &vCellVertices = Scratch.m_vCellVertices;
+		vCellVertices.assign(CellSliceSize * (aRes[2] + Padding * 2), NoVertex);
+
+		auto GetCellVertex = [&](int cx, int cy, int cz) -> unsigned int {
+			unsigned int &Vertex = vCellVertices[cx + cy * PaddedRes + cz * CellSliceSize];
+			if(Vertex != NoVertex)
+				return Vertex;
+
+			float aCorner[8];
+			for(int i = 0; i < 8; ++i)
+				aCorner[i] = vDensityGrid[(cx + aaCornerOffsets[i][0]) + (cy + aaCornerOffsets[i][1]) * PaddedRes1 + (cz + aaCornerOffsets[i][2]) * SliceSize];
 
-				for(int i = 0; i < 8; ++i)
-				{
-					int dx = aaCornerOffsets[i][0];
-					int dy = aaCornerOffsets[i][1];
-					int dz = aaCornerOffsets[i][2];
-					int idx = (x + dx) + (y + dy) * PaddedRes1 + (z + dz) * PaddedRes1 * PaddedRes1;
+			glm::vec3 Offset(0.0f);
+			int NumCrossings = 0;
+			for(int e = 0; e < 12; ++e)
+			{
+				const int c1 = aaEdgeToCorners[e][0], c2 = aaEdgeToCorners[e][1];
+				if((aCorner[c1] > 0.0f) == (aCorner[c2] > 0.0f))
+					continue;
+				const float t = (glm::abs(aCorner[c1] - aCorner[c2]) > 0.00001f) ? (0.0f - aCorner[c1]) / (aCorner[c2] - aCorner[c1]) : 0.5f;
+				Offset += glm::mix(glm::vec3(aaCornerOffsets[c1][0], aaCornerOffsets[c1][1], aaCornerOffsets[c1][2]),
+					glm::vec3(aaCornerOffsets[c2][0], aaCornerOffsets[c2][1], aaCornerOffsets[c2][2]), t);
+				++NumCrossings;
+			}
+			Offset = NumCrossings > 0 ? Offset / (float)NumCrossings : glm::vec3(0.5f);
 
-					Corners[i] = SamplingStartCorner + Vec3((double)(x + dx) * StepSize, (double)(y + dy) * StepSize, (double)(z + dz) * StepSize);
-					Densities[i] = vTerrainGrid[idx].density;
-					CornerGlobalIndices[i] = idx;
-					if(Densities[i] > 0)
-						CubeIndex |= (1 << i);
-				}
+			// Differences across the cell, the padding cells lack the neighbours for central differences
+			glm::vec3 Gradient(
+				(aCorner[1] + aCorner[2] + aCorner[5] + aCorner[6]) - (aCorner[0] + aCorner[3] + aCorner[4] + aCorner[7]),
+				(aCorner[2] + aCorner[3] + aCorner[6] + aCorner[7]) - (aCorner[0] + aCorner[1] + aCorner[4] + aCorner[5]),
+				(aCorner[4] + aCorner[5] + aCorner[6] + aCorner[7]) - (aCorner[0] + aCorner[1] + aCorner[2] + aCorner[3]));
+
+			Vec3 PosDouble;
+			if(bTile)
+			{
+				const int Corner = cx + cy * PaddedRes1 + cz * SliceSize;
+				const Vec3 Origin = GridPosition(Corner);
+				Gradient = LatticeToWorldGradient(GridPosition(Corner + 1) - Origin, GridPosition(Corner + PaddedRes1) - Origin, GridPosition(Corner + SliceSize) - Origin, Gradient);
+				PosDouble = TileDirection(Chunk.m_Face, LatticeCoordinate((double)(aLatticeStart[0] - Padding + cx) + Offset.x, LatticeSize),
+								LatticeCoordinate((double)(aLatticeStart[1] - Padding + cy) + Offset.y, LatticeSize)) *
+							(radius + ((double)(aLatticeStart[2] - Padding + cz) + Offset.z) * StepSize);
+			}
+			else
+				PosDouble = SamplingStartCorner + Vec3(((double)cx + Offset.x) * StepSize, ((double)cy + Offset.y) * StepSize, ((double)cz + Offset.z) * StepSize);
+			// The mean of the crossings is off the surface where it bends inside the cell
+			float Density = 0.0f;
+			for(int i = 0; i < 8; ++i)
+				Density += aCorner[i] * (aaCornerOffsets[i][0] ? Offset.x : 1.0f - Offset.x) * (aaCornerOffsets[i][1] ? Offset.y : 1.0f - Offset.y) *
+					   (aaCornerOffsets[i][2] ? Offset.z : 1.0f - Offset.z);
+			Vertex = EmitVertex(PosDouble, Density, Gradient);
+			return Vertex;
+		};
+
+		for(int z = Padding; z < Padding + aRes[2]; ++z)
+		{
+			for(int y = Padding; y < Padding + res; ++y)
+			{
+				for(int x = Padding; x < Padding + res; ++x)
+				{
+					const int Idx = x + y * PaddedRes1 + z * SliceSize;
+					const bool bInside = vDensityGrid[Idx] > 0.0f;
+					const int aStride[3] = {1, PaddedRes1, SliceSize};
+					for(int Axis = 0; Axis < 3; ++Axis)
+					{
+						if((vDensityGrid[Idx + aStride[Axis]] > 0.0f) == bInside)
+							continue;
+
+						// The four cells around the edge, counter-clockwise around the axis
+						const int AxisU = (Axis + 1) % 3, AxisV = (Axis + 2) % 3;
+						const int aaQuad[4][2] = {{-1, -1}, {0, -1}, {0, 0}, {-1, 0}};
+						unsigned int aQuad[4];
+						for(int q = 0; q < 4; ++q)
+						{
+							int c[3] = {x, y, z};
+							c[AxisU] += aaQuad[q][0];
+							c[AxisV] += aaQuad[q][1];
+							aQuad[q] = GetCellVertex(c[0], c[1], c[2]);
+						}
+
+						// Same winding as the marching cubes triangles, solid at the lower end means the surface faces along the axis
+						if(bInside != bFlipWinding)
+							std::swap(aQuad[1], aQuad[3]);
+
+						// Split along the shorter diagonal
+						const glm::vec3 &p0 = vVertices[aQuad[0]].position, &p1 = vVertices[aQuad[1]].position;
+						const glm::vec3 &p2 = vVertices[aQuad[2]].position, &p3 = vVertices[aQuad[3]].position;
+						const unsigned int aaTris[2][2][3] = {
+							{{aQuad[0], aQuad[1], aQuad[2]}, {aQuad[0], aQuad[2], aQuad[3]}},
+							{{aQuad[0], aQuad[1], aQuad[3]}, {aQuad[1], aQuad[2], aQuad[3]}}};
+						const int Split = glm::dot(p2 - p0, p2 - p0) <= glm::dot(p3 - p1, p3 - p1) ? 0 : 1;
+						vIndices.insert(vIndices.end(), aaTris[Split][0], aaTris[Split][0] + 3);
+						vIndices.insert(vIndices.end(), aaTris[Split][1], aaTris[Split][1] + 3);
+					}
+				}
+			}
+		}
+
+		// Surface nets have no vertices on the node faces to build transitions from
+		Mesh.m_Layout.m_NumRegularIndices = vIndices.size();
+		if(IsCancelled())
+			return false;
+		FinishMesh(Chunk, Scratch, radius, Footprint, Mesh);
+		return true;
+	}
+
+	for(int z = Padding; z < Padding + aRes[2]; ++z)
+	{
+		if(z > Padding)
+		{
+			// The top plane becomes the bottom one
+			std::swap(avXEdges[0], avXEdges[1]);
+			std::swap(avYEdges[0], avYEdges[1]);
+			std::fill(avXEdges[1].begin(), avXEdges[1].end(), NoVertex);
+			std::fill(avYEdges[1].begin(), avYEdges[1].end(), NoVertex);
+			std::fill(vZEdges.begin(), vZEdges.end(), NoVertex);
+		}
+
+		for(int y = Padding; y < Padding + res; ++y)
+		{
+			for(int x = Padding; x < Padding + res; ++x)
+			{
+				int CornerGlobalIndices[8];
+				int CubeIndex = 0;
+
+				for(int i = 0; i < 8; ++i)
+				{
+					int dx = aaCornerOffsets[i][0];
+					int dy = aaCornerOffsets[i][1];
+					int dz = aaCornerOffsets[i][2];
+					int idx = (x + dx) + (y + dy) * PaddedRes1 + (z + dz) * SliceSize;
+
+					CornerGlobalIndices[i] = idx;
+					if(vDensityGrid[idx] > 0)
+						CubeIndex |= (1 << i);
+				}
 
 				if(CubeIndex == 0 || CubeIndex == 255)
 					continue;
@@ -591,173 +1490,652 @@ void COctreeNode::GenerateMesh()
 				{
 					if(edges & (1 << i))
 					{
-						int c1_local = aaEdgeToCorners[i][0];
-						int c2_local = aaEdgeToCorners[i][1];
-						int c1_global = CornerGlobalIndices[c1_local];
-						int c2_global = CornerGlobalIndices[c2_local];
+						int c1_global = CornerGlobalIndices[aaEdgeToCorners[i][0]];
+						int c2_global = CornerGlobalIndices[aaEdgeToCorners[i][1]];
+						if(c1_global > c2_global)
+							std::swap(c1_global, c2_global);
 
-						std::pair<int, int> key = (c1_global < c2_global) ? std::make_pair(c1_global, c2_global) : std::make_pair(c2_global, c1_global);
+						const int Axis = c2_global - c1_global;
+						const int Plane = c1_global / SliceSize - z;
+						const int InSlice = c1_global % SliceSize;
+						unsigned int &EdgeVertex = Axis == 1 ? avXEdges[Plane][InSlice] : Axis == PaddedRes1 ? avYEdges[Plane][InSlice] : vZEdges[InSlice];
 
-						if(mVertexMap.find(key) == mVertexMap.end())
+						if(EdgeVertex == NoVertex)
 						{
-							Vec3 p1 = Corners[c1_local];
-							Vec3 p2 = Corners[c2_local];
-							float d1 = Densities[c1_local];
-							float d2 = Densities[c2_local];
+							EdgeVertex = EmitEdgeVertex(c1_global, c2_global);
+
+							const int EdgeAxis = Axis == 1 ? 0 : Axis == PaddedRes1 ? 1 : 2;
+							const int g[3] = {c1_global % PaddedRes1, (c1_global / PaddedRes1) % PaddedRes1, c1_global / SliceSize};
+							for(int FaceAxis = 0; FaceAxis < 3; ++FaceAxis)
+							{
+								if(FaceAxis == EdgeAxis || (g[FaceAxis] != Padding && g[FaceAxis] != Padding + aRes[FaceAxis]))
+									continue;
+								const int AxisU = (FaceAxis + 1) % 3, AxisV = (FaceAxis + 2) % 3;
+								const int Face = FaceAxis * 2 + (g[FaceAxis] == Padding ? 0 : 1);
+								avFaceEdges[Face][(EdgeAxis == AxisU ? 0 : aFaceGridSize[Face]) + (g[AxisU] - Padding) + (g[AxisV] - Padding) * (aRes[AxisU] + 1)] = EdgeVertex;
+							}
+						}
+						aEdgeVertexIndices[i] = EdgeVertex;
+					}
+				}
 
-							float t = (glm::abs(d1 - d2) > 0.00001f) ? (0.0f - d1) / (d2 - d1) : 0.5f;
+				for(int i = 0; MarchingCubesData::ms_TriTable[CubeIndex][i] != -1; i += 3)
+				{
+					vIndices.push_back(aEdgeVertexIndices[MarchingCubesData::ms_TriTable[CubeIndex][i]]);
+					vIndices.push_back(aEdgeVertexIndices[MarchingCubesData::ms_TriTable[CubeIndex][i + (bFlipWinding ? 2 : 1)]]);
+					vIndices.push_back(aEdgeVertexIndices[MarchingCubesData::ms_TriTable[CubeIndex][i + (bFlipWinding ? 1 : 2)]]);
+				}
+			}
+		}
+	}
 
-							Vec3 PosDouble = p1 * (1.0 - (double)t) + p2 * (double)t;
-							glm::vec3 Norm;
+	// ==========================================
+	// LOD TRANSITIONS
+	// ==========================================
+	// A neighbour one level finer samples the shared face at half our step, so its contour on the face differs
+	// from ours. For every face the gap between both contours is filled with flat triangles in the face plane,
+	// which are only drawn while the neighbour is finer (see HasFinerNeighbour). Vertices on our cell edges are
+	// computed exactly like the regular ones, the others from the face sampled the way the neighbour samples it.
+	// Transvoxel instead shrinks the boundary cells and fits transition cells into the gap, with the same effect.
+
+	Mesh.m_Layout.m_NumRegularIndices = vIndices.size();
+	if(IsCancelled())
+		return false;
 
-							Norm = m_pOwnerMesh->m_TerrainGenerator.CalculateDensityGradient(PosDouble, radius);
+	const double FineStep = StepSize * 0.5;
+	const double FineFootprint = Footprint * 0.5;
+
+	// Like CanContainSurface, the density changes by at most Lipschitz per unit of distance. The fine samples also add
+	// the octaves skipped at our footprint.
+	double MinElevation, MaxElevation;
+	m_TerrainGenerator.GetElevationRange(radius, MinElevation, MaxElevation);
+	const double Lipschitz = 1.0 + m_TerrainGenerator.GetElevationSlopeBound(radius) / std::max(radius + MinElevation, StepSize);
+	const double SkippedOctaves = m_TerrainGenerator.GetFootprintErrorBound(radius, Footprint);
+	const double aStartCorner[3] = {StartCorner.x, StartCorner.y, StartCorner.z};
+	const double aSamplingStartCorner[3] = {SamplingStartCorner.x, SamplingStartCorner.y, SamplingStartCorner.z};
+
+	std::vector<int> &vFineSlots = Scratch.m_vFineSlots;
+	std::vector<Vec3> &vFinePositions = Scratch.m_vFinePositions;
+	std::vector<float> &vFineDensities = Scratch.m_vFineDensities;
+	std::vector<int> &vActiveSquares = Scratch.m_vActiveSquares;
+	// Transition vertices of the current face, at the fine edges (along u, then along v) and at the grid points
+	std::vector<unsigned int> &vFineEdgeVertices = Scratch.m_vFineEdgeVertices, &vCornerVertices = Scratch.m_vCornerVertices;
+
+	// Ids of the boundary loops in a face square: 0-5 fine edges along u, 6-11 fine edges along v,
+	// 12-15 the square edges (bottom, right, top, left) and 16-19 its corners (00, 10, 11, 01)
+	auto FineEdgeU = [](int a, int b) { return a + b * 2; };
+	auto FineEdgeV = [](int a, int b) { return 6 + a + b * 3; };
+
+	// Tiles have no neighbours above or below
+	const int NumFaces = bTile ? 4 : 6;
+	for(int Face = 0; Face < NumFaces; ++Face)
+	{
+		Mesh.m_Layout.m_aTransitionFirst[Face] = vIndices.size();
+
+		const int Axis = Face / 2, AxisU = (Axis + 1) % 3, AxisV = (Axis + 2) % 3;
+		const int PlaneIndex = (Face & 1) ? Padding + aRes[Axis] : Padding;
+		const int ResU = aRes[AxisU], ResV = aRes[AxisV];
+		const int FineResU = ResU * 2 + 1, FineResV = ResV * 2 + 1;
+		vFineSlots.resize(FineResU * FineResV);
+		vFineEdgeVertices.resize(FineResU * FineResV * 2);
+		vCornerVertices.resize(aFaceGridSize[Face]);
+		auto GridIndex = [&](int u, int v) {
+			int a[3];
+			a[Axis] = PlaneIndex;
+			a[AxisU] = Padding + u;
+			a[AxisV] = Padding + v;
+			return a[0] + a[1] * PaddedRes1 + a[2] * SliceSize;
+		};
+		auto FinePosition = [&](int fu, int fv) {
+			if(bTile)
+			{
+				// On the lattice of the next level
+				int64_t a[3];
+				a[Axis] = (aLatticeStart[Axis] - Padding + PlaneIndex) * 2;
+				a[AxisU] = aLatticeStart[AxisU] * 2 + fu;
+				a[AxisV] = aLatticeStart[AxisV] * 2 + fv;
+				return TileDirection(Chunk.m_Face, LatticeCoordinate((double)a[0], LatticeSize * 2), LatticeCoordinate((double)a[1], LatticeSize * 2)) *
+					   (radius + (double)a[2] * FineStep);
+			}
+			double a[3];
+			a[Axis] = aSamplingStartCorner[Axis] + (double)PlaneIndex * StepSize;
+			a[AxisU] = aStartCorner[AxisU] + (double)fu * FineStep;
+			a[AxisV] = aStartCorner[AxisV] + (double)fv * FineStep;
+			return Vec3(a[0], a[1], a[2]);
+		};
+
+		// Squares away from the surface have the same contour at both resolutions, which is none
+		std::fill(vFineSlots.begin(), vFineSlots.end(), -1);
+		std::fill(vFineEdgeVertices.begin(), vFineEdgeVertices.end(), NoVertex);
+		std::fill(vCornerVertices.begin(), vCornerVertices.end(), NoVertex);
+		vFinePositions.clear();
+		vActiveSquares.clear();
+		for(int j = 0; j < ResV; ++j)
+		{
+			for(int i = 0; i < ResU; ++i)
+			{
+				const float d00 = vDensityGrid[GridIndex(i, j)], d10 = vDensityGrid[GridIndex(i + 1, j)];
+				const float d11 = vDensityGrid[GridIndex(i + 1, j + 1)], d01 = vDensityGrid[GridIndex(i, j + 1)];
+				const bool bSolid = d00 > 0.0f;
+				if((d10 > 0.0f) == bSolid && (d11 > 0.0f) == bSolid && (d01 > 0.0f) == bSolid)
+				{
+					// Every fine sample is within half the diagonal of the square from one of its corners
+					const double MinDensity = std::min(std::min(std::abs(d00), std::abs(d10)), std::min(std::abs(d11), std::abs(d01)));
+					const double HalfDiagonal = 0.5 * std::max((GridPosition(GridIndex(i + 1, j + 1)) - GridPosition(GridIndex(i, j))).length(),
+										  (GridPosition(GridIndex(i, j + 1)) - GridPosition(GridIndex(i + 1, j))).length());
+					if(MinDensity > Lipschitz * HalfDiagonal + SkippedOctaves)
+						continue;
+				}
 
-							STerrainOutput t1 = vTerrainGrid[c1_global];
-							STerrainOutput t2 = vTerrainGrid[c2_global];
+				vActiveSquares.push_back(i + j * ResU);
+				for(int b = 0; b < 3; ++b)
+				{
+					for(int a = 0; a < 3; ++a)
+					{
+						int &Slot = vFineSlots[(i * 2 + a) + (j * 2 + b) * FineResU];
+						if(Slot < 0)
+						{
+							Slot = vFinePositions.size();
+							vFinePositions.push_back(FinePosition(i * 2 + a, j * 2 + b));
+						}
+					}
+				}
+			}
+		}
 
-							float elev = glm::mix(t1.elevation, t2.elevation, t);
-							float temp = glm::mix(t1.temperature, t2.temperature, t);
-							float moist = glm::mix(t1.moisture, t2.moisture, t);
-							float mask = glm::mix(t1.material_mask, t2.material_mask, t);
+		if(vActiveSquares.empty())
+		{
+			Mesh.m_Layout.m_aTransitionCount[Face] = 0;
+			continue;
+		}
 
-							SProceduralVertex vert;
-							Vec3 localPos = PosDouble - m_Center;
-							vert.position = (glm::vec3)localPos;
-							vert.normal = Norm;
-							vert.texCoord = glm::vec2((float)PosDouble.x, (float)PosDouble.z) / 1000.0f;
-							vert.color_data = glm::vec4(elev, temp, moist, mask);
+		vFineDensities.resize(vFinePositions.size());
+		SampleDensities(vFinePositions.data(), (int)vFinePositions.size(), FineStep, FineFootprint, vFineDensities.data());
 
-							m_vGeneratedVertices.push_back(vert);
-							unsigned int newIndex = m_vGeneratedVertices.size() - 1;
-							mVertexMap[key] = newIndex;
-							aEdgeVertexIndices[i] = newIndex;
-						}
-						else
-							aEdgeVertexIndices[i] = mVertexMap[key];
+		for(int Square : vActiveSquares)
+		{
+			const int i = Square % ResU, j = Square / ResU;
+			const int aCornerIndex[4] = {GridIndex(i, j), GridIndex(i + 1, j), GridIndex(i + 1, j + 1), GridIndex(i, j + 1)};
+			float aCoarse[4];
+			for(int c = 0; c < 4; ++c)
+				aCoarse[c] = vDensityGrid[aCornerIndex[c]];
+			float aaFine[3][3];
+			for(int b = 0; b < 3; ++b)
+				for(int a = 0; a < 3; ++a)
+					aaFine[a][b] = vFineDensities[vFineSlots[(i * 2 + a) + (j * 2 + b) * FineResU]];
+
+			int aaLinks[20][2];
+			int aLinkCount[20] = {};
+			auto Link = [&](int A, int B) {
+				if(aLinkCount[A] < 2 && aLinkCount[B] < 2)
+				{
+					aaLinks[A][aLinkCount[A]++] = B;
+					aaLinks[B][aLinkCount[B]++] = A;
+				}
+			};
+
+			// Contour of a square with values (00, 10, 11, 01) and edges (bottom, right, top, left), saddles are decided by the center
+			auto MarchSquare = [&](const float aValue[4], const int aEdge[4]) {
+				const bool aInside[4] = {aValue[0] > 0.0f, aValue[1] > 0.0f, aValue[2] > 0.0f, aValue[3] > 0.0f};
+				const bool aCross[4] = {aInside[0] != aInside[1], aInside[1] != aInside[2], aInside[3] != aInside[2], aInside[0] != aInside[3]};
+				int aCrossing[4], NumCrossings = 0;
+				for(int e = 0; e < 4; ++e)
+					if(aCross[e])
+						aCrossing[NumCrossings++] = aEdge[e];
+				if(NumCrossings == 2)
+					Link(aCrossing[0], aCrossing[1]);
+				else if(NumCrossings == 4)
+				{
+					const bool bCenter = (aValue[0] + aValue[1] + aValue[2] + aValue[3]) > 0.0f;
+					if(bCenter == aInside[0])
+					{
+						Link(aEdge[0], aEdge[1]);
+						Link(aEdge[2], aEdge[3]);
+					}
+					else
+					{
+						Link(aEdge[3], aEdge[0]);
+						Link(aEdge[1], aEdge[2]);
 					}
 				}
+			};
 
-				for(int i = 0; MarchingCubesData::ms_TriTable[CubeIndex][i] != -1; i += 3)
+			const int aCoarseEdges[4] = {12, 13, 14, 15};
+			MarchSquare(aCoarse, aCoarseEdges);
+			for(int b = 0; b < 2; ++b)
+			{
+				for(int a = 0; a < 2; ++a)
+				{
+					const float aValue[4] = {aaFine[a][b], aaFine[a + 1][b], aaFine[a + 1][b + 1], aaFine[a][b + 1]};
+					const int aEdge[4] = {FineEdgeU(a, b), FineEdgeV(a + 1, b), FineEdgeU(a, b + 1), FineEdgeV(a, b)};
+					MarchSquare(aValue, aEdge);
+				}
+			}
+
+			// Along the square edges the loops follow the parts where only one of the two resolutions is inside
+			auto EdgeT = [](float d1, float d2) { return (glm::abs(d1 - d2) > 0.00001f) ? (0.0f - d1) / (d2 - d1) : 0.5f; };
+			struct SSide
+			{
+				int m_aCorner[2]; // corner ids at the lower and the upper end
+				int m_aCoarse[2]; // indices into aCoarse
+				int m_aaFine[3][2]; // fine points along the side
+				int m_aHalf[2]; // fine edge ids
+				int m_Edge;
+			};
+			const SSide aSides[4] = {
+				{{16, 17}, {0, 1}, {{0, 0}, {1, 0}, {2, 0}}, {FineEdgeU(0, 0), FineEdgeU(1, 0)}, 12},
+				{{17, 18}, {1, 2}, {{2, 0}, {2, 1}, {2, 2}}, {FineEdgeV(2, 0), FineEdgeV(2, 1)}, 13},
+				{{19, 18}, {3, 2}, {{0, 2}, {1, 2}, {2, 2}}, {FineEdgeU(0, 2), FineEdgeU(1, 2)}, 14},
+				{{16, 19}, {0, 3}, {{0, 0}, {0, 1}, {0, 2}}, {FineEdgeV(0, 0), FineEdgeV(0, 1)}, 15}};
+			for(const SSide &Side : aSides)
+			{
+				const float c1 = aCoarse[Side.m_aCoarse[0]], c2 = aCoarse[Side.m_aCoarse[1]];
+				float aFine[3];
+				for(int k = 0; k < 3; ++k)
+					aFine[k] = aaFine[Side.m_aaFine[k][0]][Side.m_aaFine[k][1]];
+
+				std::pair<float, int> aEvents[3];
+				int NumEvents = 0;
+				if((c1 > 0.0f) != (c2 > 0.0f))
+					aEvents[NumEvents++] = {EdgeT(c1, c2), Side.m_Edge};
+				for(int h = 0; h < 2; ++h)
+					if((aFine[h] > 0.0f) != (aFine[h + 1] > 0.0f))
+						aEvents[NumEvents++] = {(h + EdgeT(aFine[h], aFine[h + 1])) * 0.5f, Side.m_aHalf[h]};
+				std::sort(aEvents, aEvents + NumEvents);
+
+				bool bCoarseInside = c1 > 0.0f, bFineInside = aFine[0] > 0.0f;
+				int Prev = Side.m_aCorner[0];
+				for(int e = 0; e < NumEvents; ++e)
 				{
-					m_vGeneratedIndices.push_back(aEdgeVertexIndices[MarchingCubesData::ms_TriTable[CubeIndex][i]]);
-					m_vGeneratedIndices.push_back(aEdgeVertexIndices[MarchingCubesData::ms_TriTable[CubeIndex][i + 1]]);
-					m_vGeneratedIndices.push_back(aEdgeVertexIndices[MarchingCubesData::ms_TriTable[CubeIndex][i + 2]]);
+					if(bCoarseInside != bFineInside)
+						Link(Prev, aEvents[e].second);
+					if(aEvents[e].second == Side.m_Edge)
+						bCoarseInside = !bCoarseInside;
+					else
+						bFineInside = !bFineInside;
+					Prev = aEvents[e].second;
+				}
+				if(bCoarseInside != bFineInside)
+					Link(Prev, Side.m_aCorner[1]);
+			}
+
+			// Mesh vertices are only created for ids on a loop, and shared with the neighbouring squares and the regular mesh
+			unsigned int aVertex[20];
+			std::fill(aVertex, aVertex + 20, NoVertex);
+			auto CornerGradient = [&](float u, float v) {
+				return glm::mix(glm::mix(GridGradient(aCornerIndex[0]), GridGradient(aCornerIndex[1]), u),
+					glm::mix(GridGradient(aCornerIndex[3]), GridGradient(aCornerIndex[2]), u), v);
+			};
+			auto GetVertex = [&](int Id) -> unsigned int {
+				if(aVertex[Id] != NoVertex)
+					return aVertex[Id];
+				if(Id >= 16)
+				{
+					const int aaOffsets[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+					unsigned int &Vertex = vCornerVertices[(i + aaOffsets[Id - 16][0]) + (j + aaOffsets[Id - 16][1]) * (ResU + 1)];
+					if(Vertex == NoVertex)
+						Vertex = EmitVertex(GridPosition(aCornerIndex[Id - 16]), vDensityGrid[aCornerIndex[Id - 16]], GridGradient(aCornerIndex[Id - 16]));
+					aVertex[Id] = Vertex;
+				}
+				else if(Id >= 12)
+				{
+					// Bottom, right, top, left, the regular mesh has a vertex on every square edge crossing the surface
+					const int aaEdges[4][3] = {{0, 0, 0}, {1, 1, 0}, {0, 0, 1}, {1, 0, 0}};
+					const int *pEdge = aaEdges[Id - 12];
+					unsigned int &Vertex = avFaceEdges[Face][pEdge[0] * aFaceGridSize[Face] + (i + pEdge[1]) + (j + pEdge[2]) * (ResU + 1)];
+					if(Vertex == NoVertex)
+					{
+						const int aaEnds[4][2] = {{0, 1}, {1, 2}, {3, 2}, {0, 3}};
+						Vertex = EmitEdgeVertex(aCornerIndex[aaEnds[Id - 12][0]], aCornerIndex[aaEnds[Id - 12][1]]);
+					}
+					aVertex[Id] = Vertex;
+				}
+				else
+				{
+					int a, b, da = 0, db = 0;
+					if(Id < 6)
+					{
+						a = Id % 2;
+						b = Id / 2;
+						da = 1;
+					}
+					else
+					{
+						a = (Id - 6) % 3;
+						b = (Id - 6) / 3;
+						db = 1;
+					}
+					unsigned int &Vertex = vFineEdgeVertices[(da ? 0 : FineResU * FineResV) + (i * 2 + a) + (j * 2 + b) * FineResU];
+					if(Vertex == NoVertex)
+					{
+						const float t = EdgeT(aaFine[a][b], aaFine[a + da][b + db]);
+						const Vec3 PosDouble = FinePosition(i * 2 + a, j * 2 + b) * (1.0 - (double)t) + FinePosition(i * 2 + a + da, j * 2 + b + db) * (double)t;
+						Vertex = EmitVertex(PosDouble, 0.0f, CornerGradient((a + da * t) * 0.5f, (b + db * t) * 0.5f));
+					}
+					aVertex[Id] = Vertex;
+				}
+				return aVertex[Id];
+			};
+
+			bool aVisited[20] = {};
+			std::vector<int> &vLoop = Scratch.m_vLoop;
+			for(int Start = 0; Start < 20; ++Start)
+			{
+				if(aVisited[Start] || aLinkCount[Start] != 2)
+					continue;
+
+				vLoop.clear();
+				int Prev = -1, Cur = Start;
+				bool bClosed = false;
+				while(!aVisited[Cur] && aLinkCount[Cur] == 2)
+				{
+					aVisited[Cur] = true;
+					vLoop.push_back(Cur);
+					int Next = aaLinks[Cur][0] == Prev ? aaLinks[Cur][1] : aaLinks[Cur][0];
+					Prev = Cur;
+					Cur = Next;
+					if(Cur == Start)
+					{
+						bClosed = true;
+						break;
+					}
+				}
+				if(!bClosed || vLoop.size() < 3)
+					continue;
+
+				// Fan over the loop, facing the same way as the surface around it
+				for(size_t k = 1; k + 1 < vLoop.size(); ++k)
+				{
+					unsigned int aTri[3] = {GetVertex(vLoop[0]), GetVertex(vLoop[k]), GetVertex(vLoop[k + 1])};
+					const glm::vec3 &p0 = vVertices[aTri[0]].position;
+					const glm::vec3 &p1 = vVertices[aTri[1]].position;
+					const glm::vec3 &p2 = vVertices[aTri[2]].position;
+					glm::vec3 SurfaceNormal = vVertices[aTri[0]].normal + vVertices[aTri[1]].normal + vVertices[aTri[2]].normal;
+					if(glm::dot(glm::cross(p1 - p0, p2 - p0), SurfaceNormal) < 0.0f)
+						std::swap(aTri[1], aTri[2]);
+					vIndices.insert(vIndices.end(), aTri, aTri + 3);
 				}
 			}
 		}
-	}
 
-	// ==========================================
-	// SKIRT GENERATION
-	// ==========================================
-	// This pass detects vertices on the edges of the chunk and generates "skirts"
-	// (geometry pointing inwards) to hide gaps between different LOD levels.
-
-	float BoundsLimit = (float)(m_Size * 0.5) * 0.99f;
-	float SkirtDepth = (float)(StepSize * 0.5); // Depth of the skirt, proportional to voxel size
-
-	// Helper to determine boundary mask for a position
-	// 1: x-, 2: x+, 4: y-, 8: y+, 16: z-, 32: z+
-	auto GetBoundaryMask = [&](const glm::vec3 &p) -> int {
-		int mask = 0;
-		if(p.x < -BoundsLimit)
-			mask |= 1;
-		if(p.x > BoundsLimit)
-			mask |= 2;
-		if(p.y < -BoundsLimit)
-			mask |= 4;
-		if(p.y > BoundsLimit)
-			mask |= 8;
-		if(p.z < -BoundsLimit)
-			mask |= 16;
-		if(p.z > BoundsLimit)
-			mask |= 32;
-		return mask;
-	};
+		Mesh.m_Layout.m_aTransitionCount[Face] = vIndices.size() - Mesh.m_Layout.m_aTransitionFirst[Face];
+	}
 
-	// We iterate only the currently generated triangles before adding skirts
-	size_t OriginalIndexCount = m_vGeneratedIndices.size();
+	if(IsCancelled())
+		return false;
+	FinishMesh(Chunk, Scratch, radius, Footprint, Mesh);
+	return true;
+}
 
-	// Map to reuse skirt vertices: key is (original_vertex_index << 6) | boundary_mask
-	// This prevents adding duplicate skirt vertices for the same corner
-	std::unordered_map<uint64_t, unsigned int> SkirtVertexMap;
+void CProceduralMesh::FinishMesh(const SChunkDesc &Chunk, SGenerationScratch &Scratch, double PlanetRadius, double Footprint, SMeshData &Mesh)
+{
+	std::vector<SProceduralVertex> &vVertices = Scratch.m_vVertices;
+	const std::vector<unsigned int> &vIndices = Scratch.m_vIndices;
+	const std::vector<Vec3> &vVertexPositions = Scratch.m_vVertexPositions;
+
+	// Biome attributes at the vertices, the elevations come from the density grid
+	std::vector<STerrainOutput> &vVertexTerrain = Scratch.m_vVertexTerrain;
+	vVertexTerrain.resize(vVertexPositions.size());
+	m_TerrainGenerator.GetBiomes(vVertexPositions.data(), Scratch.m_vVertexElevations.data(), (int)vVertexPositions.size(), PlanetRadius, vVertexTerrain.data());
+	for(size_t i = 0; i < vVertexTerrain.size(); ++i)
+	{
+		const STerrainOutput &Terrain = vVertexTerrain[i];
+		vVertices[i].color_data = glm::vec4(Terrain.elevation, Terrain.temperature, Terrain.moisture, Terrain.material_mask);
+	}
 
-	auto GetOrCreateSkirtVertex = [&](unsigned int originalIdx, int boundaryMask) -> unsigned int {
-		uint64_t key = ((uint64_t)originalIdx << 6) | (uint64_t)boundaryMask;
-		if(SkirtVertexMap.find(key) != SkirtVertexMap.end())
-			return SkirtVertexMap[key];
+	// Positions are snapped to a power of two fraction of the voxel step, so vertices on a face shared with a
+	// neighbour, whose lattice is the same or twice as fine, land on the same spot in both nodes
+	const int res = Chunk.m_VoxelResolution;
+	const double StepSize = Chunk.m_Size / (double)res;
+	const int PositionRange = res + GRID_PADDING * 2;
+	const double UnitsPerStep = std::exp2(std::floor(std::log2(65535.0 / (double)PositionRange)));
+	Vec3 Origin = Chunk.m_Center - Vec3((double)PositionRange * 0.5 * StepSize);
+	double LatticeScale = UnitsPerStep / StepSize;
+	Mesh.m_Layout.m_PositionScale = (float)(StepSize / UnitsPerStep);
+	Mesh.m_Layout.m_PositionOffset = glm::vec3((float)(-(double)PositionRange * 0.5 * StepSize));
+
+	Vec3 Min(DBL_MAX), Max(-DBL_MAX);
+	double MinRadius = DBL_MAX, MaxRadius = 0.0;
+	for(const Vec3 &Position : vVertexPositions)
+	{
+		Min = Vec3(std::min(Min.x, Position.x), std::min(Min.y, Position.y), std::min(Min.z, Position.z));
+		Max = Vec3(std::max(Max.x, Position.x), std::max(Max.y, Position.y), std::max(Max.z, Position.z));
+		const double Radius = Position.length();
+		MinRadius = std::min(MinRadius, Radius);
+		MaxRadius = std::max(MaxRadius, Radius);
+	}
+	if(!vVertexPositions.empty())
+	{
+		// The finer levels interpolate within smaller voxels and add the octaves skipped here
+		const double Margin = StepSize + m_TerrainGenerator.GetFootprintErrorBound(PlanetRadius, Footprint);
+		Mesh.m_BoundsMin = Min - Vec3(Margin);
+		Mesh.m_BoundsMax = Max + Vec3(Margin);
+		Mesh.m_MinElevation = MinRadius - PlanetRadius - Margin;
+		Mesh.m_MaxElevation = MaxRadius - PlanetRadius + Margin;
+	}
 
-		SProceduralVertex NewVert = m_vGeneratedVertices[originalIdx];
-		// Move vertex "down" relative to the surface normal to create a skirt
-		NewVert.position -= NewVert.normal * SkirtDepth;
+	if(Chunk.m_Face >= 0 && !vVertexPositions.empty())
+	{
+		// Tiles are no cubes and span a varying radial range, they use a lattice of power of two world units anchored
+		// at the body center instead. Its spacing only depends on the level and leaves room for bounding boxes of
+		// two tile widths, so neighbours snap their shared vertices alike. Taller tiles fall back to a coarser lattice.
+		const double Extent = std::max(std::max(Max.x - Min.x, Max.y - Min.y), Max.z - Min.z);
+		double Spacing = std::exp2(std::ceil(std::log2(2.0 * (double)PositionRange * StepSize / 65535.0)));
+		while(Extent / Spacing > 65534.0)
+			Spacing *= 2.0;
+		LatticeScale = 1.0 / Spacing;
+		Origin = Vec3(std::floor(Min.x * LatticeScale), std::floor(Min.y * LatticeScale), std::floor(Min.z * LatticeScale)) * Spacing;
+		Mesh.m_Layout.m_PositionScale = (float)Spacing;
+		Mesh.m_Layout.m_PositionOffset = (glm::vec3)(Origin - Chunk.m_Center);
+	}
 
-		m_vGeneratedVertices.push_back(NewVert);
-		unsigned int newIdx = (unsigned int)m_vGeneratedVertices.size() - 1;
-		SkirtVertexMap[key] = newIdx;
-		return newIdx;
-	};
+	// The packed positions are off by up to half a step on every axis
+	Mesh.m_Occluder.m_bValid = false;
+	if(Chunk.m_Face >= 0 && !vIndices.empty())
+		BuildTileOccluder(Chunk, Scratch, PlanetRadius, (double)Mesh.m_Layout.m_PositionScale, Mesh.m_Occluder);
 
-	for(size_t i = 0; i < OriginalIndexCount; i += 3)
+	const Vec3 OriginUnits = Origin * LatticeScale;
+	const long long aOriginUnits[3] = {std::llround(OriginUnits.x), std::llround(OriginUnits.y), std::llround(OriginUnits.z)};
+	AcquireMeshData(Mesh);
+	Mesh.m_vVertices.resize(vVertices.size());
+	for(size_t i = 0; i < vVertices.size(); ++i)
 	{
-		unsigned int i1 = m_vGeneratedIndices[i];
-		unsigned int i2 = m_vGeneratedIndices[i + 1];
-		unsigned int i3 = m_vGeneratedIndices[i + 2];
+		const SProceduralVertex &Vertex = vVertices[i];
+		SPackedVertex &Packed = Mesh.m_vVertices[i];
+
+		// Rounded before the origin is taken off, which keeps the rounding independent of the origin
+		const Vec3 Lattice = vVertexPositions[i] * LatticeScale;
+		const double aLattice[3] = {Lattice.x, Lattice.y, Lattice.z};
+		for(int c = 0; c < 3; ++c)
+			Packed.m_aPosition[c] = (uint16_t)std::clamp(std::llround(aLattice[c]) - aOriginUnits[c], 0LL, 65535LL);
+		Packed.m_aPosition[3] = 0;
+
+		// Octahedral normal, the lower hemisphere is folded over the diagonals
+		glm::vec3 n = Vertex.normal / (std::abs(Vertex.normal.x) + std::abs(Vertex.normal.y) + std::abs(Vertex.normal.z));
+		glm::vec2 Oct(n.x, n.y);
+		if(n.z < 0.0f)
+			Oct = glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+		Packed.m_aNormal[0] = (int16_t)std::lround(glm::clamp(Oct.x, -1.0f, 1.0f) * 32767.0f);
+		Packed.m_aNormal[1] = (int16_t)std::lround(glm::clamp(Oct.y, -1.0f, 1.0f) * 32767.0f);
+
+		// The elevation of very large bodies would overflow a half float
+		for(int c = 0; c < 4; ++c)
+			Packed.m_aColorData[c] = glm::packHalf1x16(std::clamp(Vertex.color_data[c], -65504.0f, 65504.0f));
+	}
 
-		int m1 = GetBoundaryMask(m_vGeneratedVertices[i1].position);
-		int m2 = GetBoundaryMask(m_vGeneratedVertices[i2].position);
-		int m3 = GetBoundaryMask(m_vGeneratedVertices[i3].position);
+	if(vVertices.size() <= 65536)
+		Mesh.m_vShortIndices.assign(vIndices.begin(), vIndices.end());
+	else
+		Mesh.m_vIndices.assign(vIndices.begin(), vIndices.end());
+}
 
-		// Check Edge 1-2
-		int EdgeMask = m1 & m2;
-		if(EdgeMask != 0)
-		{
-			unsigned int s1 = GetOrCreateSkirtVertex(i1, EdgeMask);
-			unsigned int s2 = GetOrCreateSkirtVertex(i2, EdgeMask);
-			// Add Quad (Triangle 1)
-			m_vGeneratedIndices.push_back(i1);
-			m_vGeneratedIndices.push_back(s1);
-			m_vGeneratedIndices.push_back(i2);
-			// Add Quad (Triangle 2)
-			m_vGeneratedIndices.push_back(i2);
-			m_vGeneratedIndices.push_back(s1);
-			m_vGeneratedIndices.push_back(s2);
-		}
+void COctreeNode::Init(CProceduralMesh *pOwnerMesh, uint32_t Index, uint32_t Parent, Vec3 center, double size, int level, int voxelResolution)
+{
+	m_pOwnerMesh = pOwnerMesh;
+	m_Index = Index;
+	m_Parent = Parent;
+	m_FirstChild = CProceduralMesh::NO_NODE;
+	m_Level = level;
+	m_VoxelResolution = voxelResolution;
+	m_Center = center;
+	m_Size = size;
+	m_Face = -1;
+	m_BoundsCenter = center;
+	m_BoundsHalfSize = Vec3(size * 0.5);
+	m_BoundingRadius = m_BoundsHalfSize.length();
+	pOwnerMesh->m_TerrainGenerator.GetElevationRange(pOwnerMesh->m_pBody->m_RenderParams.m_Radius, m_aElevationRange[0], m_aElevationRange[1]);
+	m_Occluder.m_bValid = false;
+	m_bIsGenerating = false;
+	m_bGenerationAttempted = false;
+	m_bPrefetched = false;
+	m_bBalanceRequest = false;
+	m_bLodCulled = false;
+	m_bLodSplit = false;
+	m_bLodMerge = false;
+	m_LodSlack = -1.0;
+	m_LastLodChange = -DBL_MAX;
+}
 
-		// Check Edge 2-3
-		EdgeMask = m2 & m3;
-		if(EdgeMask != 0)
-		{
-			unsigned int s2 = GetOrCreateSkirtVertex(i2, EdgeMask);
-			unsigned int s3 = GetOrCreateSkirtVertex(i3, EdgeMask);
-			m_vGeneratedIndices.push_back(i2);
-			m_vGeneratedIndices.push_back(s2);
-			m_vGeneratedIndices.push_back(i3);
-			m_vGeneratedIndices.push_back(i3);
-			m_vGeneratedIndices.push_back(s2);
-			m_vGeneratedIndices.push_back(s3);
-		}
+void COctreeNode::InitTile(CProceduralMesh *pOwnerMesh, uint32_t Index, uint32_t Parent, int face, int64_t tileU, int64_t tileV, int level, int voxelResolution, double MinElevation, double MaxElevation)
+{
+	// Centered on the sphere, the size is the width there so the voxels come out about cubic
+	const double Radius = pOwnerMesh->m_pBody->m_RenderParams.m_Radius;
+	const double TileSize = std::ldexp(2.0, -level);
+	const Vec3 Center = TileDirection(face, -1.0 + ((double)tileU + 0.5) * TileSize, -1.0 + ((double)tileV + 0.5) * TileSize) * Radius;
+	Init(pOwnerMesh, Index, Parent, Center, std::ldexp(Radius * PI * 0.5, -level), level, voxelResolution);
+	m_Face = face;
+	m_aTile[0] = tileU;
+	m_aTile[1] = tileV;
+	SetTileBounds(MinElevation, MaxElevation);
+}
+
+SMeshKey COctreeNode::GetMeshKey() const
+{
+	if(IsTile())
+		return {m_Face, m_Level, {m_aTile[0], m_aTile[1], 0}};
 
-		// Check Edge 3-1
-		EdgeMask = m3 & m1;
-		if(EdgeMask != 0)
+	// The cube on the lattice of its level, the root is centered on the body
+	const double Half = m_pOwnerMesh->m_RootSize * 0.5;
+	return {-1, m_Level, {std::llround((m_Center.x + Half) / m_Size - 0.5), std::llround((m_Center.y + Half) / m_Size - 0.5), std::llround((m_Center.z + Half) / m_Size - 0.5)}};
+}
+
+void COctreeNode::SetTileBounds(double MinElevation, double MaxElevation)
+{
+	// Box around the corners, the edge midpoints and the center at both radii, the sphere bulges past those points
+	// by at most the sagitta of half the tile
+	const double Radius = m_pOwnerMesh->m_pBody->m_RenderParams.m_Radius;
+	const double TileSize = std::ldexp(2.0, -m_Level);
+	Vec3 Min(DBL_MAX), Max(-DBL_MAX);
+	for(int j = 0; j <= 2; ++j)
+	{
+		for(int i = 0; i <= 2; ++i)
 		{
-			unsigned int s3 = GetOrCreateSkirtVertex(i3, EdgeMask);
-			unsigned int s1 = GetOrCreateSkirtVertex(i1, EdgeMask);
-			m_vGeneratedIndices.push_back(i3);
-			m_vGeneratedIndices.push_back(s3);
-			m_vGeneratedIndices.push_back(i1);
-			m_vGeneratedIndices.push_back(i1);
-			m_vGeneratedIndices.push_back(s3);
-			m_vGeneratedIndices.push_back(s1);
+			const Vec3 Dir = TileDirection(m_Face, -1.0 + ((double)m_aTile[0] + i * 0.5) * TileSize, -1.0 + ((double)m_aTile[1] + j * 0.5) * TileSize);
+			for(double Elevation : {MinElevation, MaxElevation})
+			{
+				const Vec3 Point = Dir * (Radius + Elevation);
+				Min = Vec3(std::min(Min.x, Point.x), std::min(Min.y, Point.y), std::min(Min.z, Point.z));
+				Max = Vec3(std::max(Max.x, Point.x), std::max(Max.y, Point.y), std::max(Max.z, Point.z));
+			}
 		}
 	}
+	const double Bulge = (Radius + MaxElevation) * (1.0 - std::cos(TileSize * PI * 0.125));
+	m_BoundsCenter = (Min + Max) * 0.5;
+	m_BoundsHalfSize = (Max - Min) * 0.5 + Vec3(Bulge);
+	m_BoundingRadius = m_BoundsHalfSize.length();
+	m_aElevationRange[0] = MinElevation;
+	m_aElevationRange[1] = MaxElevation;
+	m_LodSlack = -1.0;
+}
+
+void COctreeNode::SetMeshBounds(const SMeshData &Mesh)
+{
+	// Tiles rebuild their box from the radial range, it follows the curvature closer than the box of the vertices
+	if(IsTile())
+		SetTileBounds(Mesh.m_MinElevation, Mesh.m_MaxElevation);
+	else
+	{
+		m_aElevationRange[0] = std::max(m_aElevationRange[0], Mesh.m_MinElevation);
+		m_aElevationRange[1] = std::min(m_aElevationRange[1], Mesh.m_MaxElevation);
+	}
+	ClipBounds(Mesh.m_BoundsMin, Mesh.m_BoundsMax);
+}
+
+bool COctreeNode::ClipBounds(const Vec3 &Min, const Vec3 &Max)
+{
+	const Vec3 BoxMin = m_BoundsCenter - m_BoundsHalfSize, BoxMax = m_BoundsCenter + m_BoundsHalfSize;
+	const Vec3 NewMin(std::max(BoxMin.x, Min.x), std::max(BoxMin.y, Min.y), std::max(BoxMin.z, Min.z));
+	const Vec3 NewMax(std::min(BoxMax.x, Max.x), std::min(BoxMax.y, Max.y), std::min(BoxMax.z, Max.z));
+	if(NewMin.x > NewMax.x || NewMin.y > NewMax.y || NewMin.z > NewMax.z)
+		return false;
+	m_BoundsCenter = (NewMin + NewMax) * 0.5;
+	m_BoundsHalfSize = (NewMax - NewMin) * 0.5;
+	m_BoundingRadius = m_BoundsHalfSize.length();
+	m_LodSlack = -1.0;
+	return true;
+}
+
+bool COctreeNode::IsInView(const Vec3 &CamPos, double *pMargin) const
+{
+	// Horizon culling from the planet center to the camera vs the chunk, the test does not depend on the orientation
+	const CProceduralMesh *pMesh = m_pOwnerMesh;
+	double HorizonMargin;
+	const bool bOccluded = IsChunkOccluded(m_BoundsCenter, m_BoundingRadius, pMesh->m_pBody->m_RenderParams.m_Radius + m_aElevationRange[1], CamPos, pMesh->m_OccluderRadius, &HorizonMargin);
+	if(pMargin)
+		*pMargin = HorizonMargin;
+	if(bOccluded)
+		return false;
+
+	Vec3 NodePosRelCam = pMesh->m_pBody->m_SimParams.m_Orientation.RotateVector(m_BoundsCenter - CamPos);
+	float FrustumMargin;
+	const bool bVisible = IsSphereInFrustum(pMesh->m_FrustumPlanes, (glm::vec3)NodePosRelCam, (float)m_BoundingRadius, &FrustumMargin);
+	if(pMargin)
+		*pMargin = std::min(*pMargin, (double)FrustumMargin);
+	return bVisible;
+}
+
+void COctreeNode::Release()
+{
+	if(m_bPrefetched)
+		++m_pOwnerMesh->m_PrefetchStats.m_Wasted;
+	// Slots of a block that never held a node have no owner
+	if(m_pOwnerMesh)
+		m_pOwnerMesh->StoreCachedMesh(*this);
+	CancelGeneration();
+	if(m_VAO != 0)
+	{
+		glDeleteBuffers(1, &m_EBO);
+		glDeleteBuffers(1, &m_VBO);
+		glDeleteVertexArrays(1, &m_VAO);
+		m_VAO = 0;
+		m_VBO = 0;
+		m_EBO = 0;
+		m_NumVertices = 0;
+		m_NumIndices = 0;
+	}
+	m_bGenerationAttempted = false;
+	m_FirstChild = CProceduralMesh::NO_NODE;
+	++m_Generation;
+}
 
-	m_bHasGeneratedData = true;
+void COctreeNode::CancelGeneration()
+{
+	if(m_pGenerationCancel)
+	{
+		m_pGenerationCancel->store(true);
+		m_pGenerationCancel.reset();
+	}
 	m_bIsGenerating = false;
+	m_bPrefetched = false;
+	m_bBalanceRequest = false;
 }
 
-void COctreeNode::ApplyMeshBuffers()
+void COctreeNode::ApplyMeshBuffers(const SMeshData &Mesh)
 {
+	m_bIsGenerating = false;
+	m_bGenerationAttempted = true;
+	m_pGenerationCancel.reset();
+
 	if(m_EBO != 0)
 		glDeleteBuffers(1, &m_EBO);
 	if(m_VBO != 0)
@@ -765,18 +2143,23 @@ void COctreeNode::ApplyMeshBuffers()
 	if(m_VAO != 0)
 		glDeleteVertexArrays(1, &m_VAO);
 
-	m_NumIndices = m_vGeneratedIndices.size();
+	const bool bShortIndices = !Mesh.m_vShortIndices.empty();
+	m_NumVertices = Mesh.m_vVertices.size();
+	m_NumIndices = bShortIndices ? Mesh.m_vShortIndices.size() : Mesh.m_vIndices.size();
+	m_IndexType = bShortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	m_Layout = Mesh.m_Layout;
+	m_Occluder = Mesh.m_Occluder;
 
 	if(m_NumIndices == 0)
 	{
 		m_VAO = 0;
 		m_VBO = 0;
 		m_EBO = 0;
-		m_bHasGeneratedData = false;
-		m_bGenerationAttempted = true;
 		return;
 	}
 
+	SetMeshBounds(Mesh);
+
 	glGenVertexArrays(1, &m_VAO);
 	glGenBuffers(1, &m_VBO);
 	glGenBuffers(1, &m_EBO);
@@ -784,108 +2167,193 @@ void COctreeNode::ApplyMeshBuffers()
 	glBindVertexArray(m_VAO);
 
 	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-	glBufferData(GL_ARRAY_BUFFER, m_vGeneratedVertices.size() * sizeof(SProceduralVertex), m_vGeneratedVertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, Mesh.m_vVertices.size() * sizeof(SPackedVertex), Mesh.m_vVertices.data(), GL_STATIC_DRAW);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_vGeneratedIndices.size() * sizeof(unsigned int), m_vGeneratedIndices.data(), GL_STATIC_DRAW);
+	if(bShortIndices)
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, Mesh.m_vShortIndices.size() * sizeof(uint16_t), Mesh.m_vShortIndices.data(), GL_STATIC_DRAW);
+	else
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, Mesh.m_vIndices.size() * sizeof(unsigned int), Mesh.m_vIndices.data(), GL_STATIC_DRAW);
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SProceduralVertex), (void *)0);
+	glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(SPackedVertex), (void *)offsetof(SPackedVertex, m_aPosition));
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(SProceduralVertex), (void *)offsetof(SProceduralVertex, normal));
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(SPackedVertex), (void *)offsetof(SPackedVertex, m_aNormal));
 	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(SProceduralVertex), (void *)offsetof(SProceduralVertex, texCoord));
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(SProceduralVertex), (void *)offsetof(SProceduralVertex, color_data));
+	glVertexAttribPointer(3, 4, GL_HALF_FLOAT, GL_FALSE, sizeof(SPackedVertex), (void *)offsetof(SPackedVertex, m_aColorData));
 	glEnableVertexAttribArray(3);
 
 	glBindVertexArray(0);
-
-	m_vGeneratedVertices.clear();
-	m_vGeneratedIndices.clear();
-	m_bHasGeneratedData = false;
-	m_bGenerationAttempted = true;
 }
 
-void COctreeNode::Update(CCamera &Camera)
+bool COctreeNode::NeedsLodEvaluation() const
 {
-	bool bSplit;
-	bool bMerge;
-	double DistToBox = 0.f;
+	if(m_LodEpoch != m_pOwnerMesh->m_LodEpoch)
+		return true;
 
-	// split until minimum is hit
-	if(m_pOwnerMesh->m_pBody == Camera.m_pFocusedBody && m_Level <= 3)
+	// A rotation of the planes by Turn moves them by at most Turn * distance at the node
+	const double Travel = m_pOwnerMesh->m_LodTravel - m_LodTravel;
+	const double Turn = m_pOwnerMesh->m_LodTurn - m_LodTurn;
+	return Travel + Turn * (m_LodDistance + Travel) >= m_LodSlack;
+}
+
+void COctreeNode::EvaluateLod(const CCamera &Camera)
+{
+	CProceduralMesh *pMesh = m_pOwnerMesh;
+	++pMesh->m_NumLodEvaluations;
+	m_LodEpoch = pMesh->m_LodEpoch;
+	m_LodTravel = pMesh->m_LodTravel;
+	m_LodTurn = pMesh->m_LodTurn;
+
+	const Vec3 CamPosLocal = pMesh->m_LodCamPos;
+	m_LodDistance = (m_BoundsCenter - CamPosLocal).length();
+	m_bLodCulled = false;
+
+	// split until minimum is hit, this only changes with the focus
+	if(pMesh->m_pBody == Camera.m_pFocusedBody && m_Level <= (IsTile() ? 2 : 3))
 	{
-		bSplit = true;
-		bMerge = false;
+		m_bLodSplit = true;
+		m_bLodMerge = false;
+		m_LodPriority = 0.0;
+		m_LodSlack = DBL_MAX;
+		return;
 	}
-	else
-	{
-		Vec3 CamPosRelPlanet = Camera.m_AbsolutePosition - m_pOwnerMesh->m_pBody->m_SimParams.m_Position;
 
-		Quat q = m_pOwnerMesh->m_pBody->m_SimParams.m_Orientation;
-		Vec3 CamPosLocal = q.Conjugate().RotateVector(CamPosRelPlanet);
-
-		Vec3 NodeCenterWorld = q.RotateVector(m_Center);
-		double sphereRadius = m_Size * 0.9;
-
-		if(m_Level > 0)
-		{
-			// Horizon Culling Planet Center to Camera vs Chunk
-			if(IsChunkOccluded(NodeCenterWorld, m_Size, CamPosRelPlanet, m_pOwnerMesh->m_pBody->m_RenderParams.m_Radius))
-			{
-				if(!m_bIsLeaf)
-					Merge();
-				return;
-			}
+	double Slack = DBL_MAX;
+	if((m_Level > 0 || IsTile()) && !IsInView(CamPosLocal, &Slack))
+	{
+		m_bLodCulled = true;
+		m_LodSlack = Slack;
+		return;
+	}
 
-			// Frustum Culling
-			Vec3 NodePosRelCam = NodeCenterWorld - CamPosRelPlanet;
-			if(!IsSphereInFrustum(m_pOwnerMesh->m_FrustumPlanes, (glm::vec3)NodePosRelCam, (float)sphereRadius))
-			{
-				if(!m_bIsLeaf)
-					Merge();
-				return;
-			}
-		}
+	// The box distance changes at most as fast as the camera moves
+	double DistToBox = std::max(0.1, GetDistanceToBox(CamPosLocal, m_BoundsCenter, m_BoundsHalfSize));
+	double Ratio = m_Size / DistToBox;
+	// Nodes the camera is heading for stay split, Prefetch may have split them ahead of time
+	double PrefetchDistToBox = std::max(0.1, GetDistanceToBox(pMesh->m_PrefetchCamPos, m_BoundsCenter, m_BoundsHalfSize));
+	m_bLodSplit = Ratio > pMesh->m_SplitMultiplier;
+	m_bLodMerge = Ratio < pMesh->m_MergeMultiplier && m_Size / PrefetchDistToBox < pMesh->m_MergeMultiplier;
+	m_LodPriority = DistToBox;
+
+	Slack = std::min(Slack, std::abs(DistToBox - m_Size / pMesh->m_SplitMultiplier));
+	Slack = std::min(Slack, std::abs(DistToBox - m_Size / pMesh->m_MergeMultiplier));
+	Slack = std::min(Slack, std::abs(PrefetchDistToBox - m_Size / pMesh->m_MergeMultiplier));
+	m_LodSlack = Slack;
+}
 
-		DistToBox = std::max(0.1, GetDistanceToBox(CamPosLocal, m_Center, m_Size));
+void COctreeNode::Update(CCamera &Camera)
+{
+	// Nodes the camera cannot have moved enough for keep acting on their last decision, as do all once the budget is used up
+	if(NeedsLodEvaluation() && std::chrono::steady_clock::now() < m_pOwnerMesh->m_LodDeadline)
+		EvaluateLod(Camera);
 
-		double Ratio = m_Size / DistToBox;
+	if(m_bLodCulled)
+	{
+		if(!IsLeaf() && CanChangeLod() && CanMerge())
+			Merge();
+		return;
+	}
 
-		bSplit = Ratio > m_pOwnerMesh->m_SplitMultiplier;
-		bMerge = Ratio < m_pOwnerMesh->m_MergeMultiplier;
+	// Needed now, the prefetch either came through in time or becomes a regular task with the next refresh of the queue
+	CProceduralMesh::SPrefetchStats &Stats = m_pOwnerMesh->m_PrefetchStats;
+	if(m_bPrefetched && m_bLodSplit)
+	{
+		m_bPrefetched = false;
+		if(m_bIsGenerating)
+			++Stats.m_Late;
+		else
+			++Stats.m_Hits;
 	}
 
-	if(m_bIsLeaf)
+	if(IsLeaf())
 	{
-		if(bSplit && m_Level < MAX_LOD_LEVEL)
+		if(m_bLodSplit && m_Level < (IsTile() ? MAX_TILE_LEVEL : MAX_LOD_LEVEL))
 		{
 			if(m_VAO != 0)
 			{
-				Subdivide();
-				for(int i = 0; i < 8; ++i)
-					m_pChildren[i]->Update(Camera);
+				if(CanChangeLod() && PrepareSubdivide())
+				{
+					Subdivide();
+					for(int i = 0; i < GetNumChildren(); ++i)
+						GetChild(i).Update(Camera);
+				}
 			}
-			else if(!m_bIsGenerating && !m_bHasGeneratedData && !m_bGenerationAttempted)
+			else if(!m_bIsGenerating && !m_bGenerationAttempted)
 			{
 				m_bIsGenerating = true;
+				if(m_pOwnerMesh->m_bPrefetchActive)
+					++Stats.m_Misses;
 				// Add to queue with distance priority!
-				m_pOwnerMesh->AddToGenerationQueue(shared_from_this(), DistToBox);
+				m_pOwnerMesh->AddToGenerationQueue(m_Index, m_LodPriority);
 			}
 		}
 	}
 	else
 	{
-		if(bMerge && m_Level > 0)
+		if(m_bLodMerge && m_Level > 0 && CanChangeLod() && CanMerge())
 			Merge();
 		else
-			for(int i = 0; i < 8; ++i)
-				m_pChildren[i]->Update(Camera);
+			for(int i = 0; i < GetNumChildren(); ++i)
+				GetChild(i).Update(Camera);
 	}
 }
 
-void COctreeNode::Render(CShader &Shader, const Vec3 &CameraAbsolutePos, const Vec3 &PlanetAbsolutePos, const Quat &PlanetOrientation)
+void COctreeNode::Prefetch()
 {
+	CProceduralMesh *pMesh = m_pOwnerMesh;
+	if(std::chrono::steady_clock::now() >= pMesh->m_LodDeadline)
+		return;
+
+	// The same tests as EvaluateLod, the view is assumed to keep its orientation
+	const Vec3 CamPos = pMesh->m_PrefetchCamPos;
+	if((m_Level > 0 || IsTile()) && !IsInView(CamPos))
+		return;
+
+	if(!IsLeaf())
+	{
+		for(int i = 0; i < GetNumChildren(); ++i)
+			GetChild(i).Prefetch();
+		return;
+	}
+
+	if(m_bIsGenerating || m_Level >= (IsTile() ? MAX_TILE_LEVEL : MAX_LOD_LEVEL))
+		return;
+	double DistToBox = std::max(0.1, GetDistanceToBox(CamPos, m_BoundsCenter, m_BoundsHalfSize));
+	if(m_Size / DistToBox <= pMesh->m_SplitMultiplier)
+		return;
+
+	if(m_VAO != 0)
+	{
+		// Split ahead of time so the children get prefetched as well. Culled nodes would only merge again.
+		if(!m_bLodCulled && CanChangeLod() && PrepareSubdivide())
+		{
+			Subdivide();
+			for(int i = 0; i < GetNumChildren(); ++i)
+				GetChild(i).Prefetch();
+		}
+	}
+	else if(!m_bGenerationAttempted)
+	{
+		m_bIsGenerating = true;
+		m_bPrefetched = true;
+		pMesh->AddToGenerationQueue(m_Index, DistToBox, true);
+	}
+}
+
+void COctreeNode::Render(CShader &Shader, const Vec3 &CameraAbsolutePos, const Vec3 &PlanetAbsolutePos, const Quat &PlanetOrientation, bool bCull)
+{
+	CProceduralMesh *pMesh = m_pOwnerMesh;
+	if(bCull && (m_Level > 0 || IsTile()))
+	{
+		if(!IsInView(pMesh->m_LodCamPos))
+			return;
+		if(pMesh->m_bOcclusionActive && IsOccluded(pMesh->m_OcclusionBuffer))
+		{
+			++pMesh->m_NumOccludedNodes;
+			return;
+		}
+	}
+
 	Vec3 PlanetToCam = PlanetAbsolutePos - CameraAbsolutePos;
 	Vec3 NodeCenterWorld = PlanetOrientation.RotateVector(m_Center);
 	Vec3 NodeToCam = PlanetToCam + NodeCenterWorld;
@@ -896,81 +2364,302 @@ void COctreeNode::Render(CShader &Shader, const Vec3 &CameraAbsolutePos, const V
 
 	glm::mat4 NodeModel = MatTranslate * MatRotate;
 
-	if(m_bIsLeaf)
+	if(IsLeaf() || !AreChildrenReady())
+		DrawMesh(Shader, NodeModel);
+	else
+	{
+		for(int i = 0; i < GetNumChildren(); ++i)
+			GetChild(i).Render(Shader, CameraAbsolutePos, PlanetAbsolutePos, PlanetOrientation, bCull);
+	}
+}
+
+void COctreeNode::CollectOccluders(std::vector<std::pair<double, uint32_t>> &vCandidates) const
+{
+	const CProceduralMesh *pMesh = m_pOwnerMesh;
+	if((m_Level > 0 || IsTile()) && !IsInView(pMesh->m_LodCamPos))
+		return;
+
+	if(IsLeaf() || !AreChildrenReady())
+	{
+		if(m_Occluder.m_bValid && m_VAO != 0)
+			vCandidates.emplace_back(GetDistanceToBox(pMesh->m_LodCamPos, m_BoundsCenter, m_BoundsHalfSize), m_Index);
+	}
+	else
+	{
+		for(int i = 0; i < GetNumChildren(); ++i)
+			GetChild(i).CollectOccluders(vCandidates);
+	}
+}
+
+void COctreeNode::DrawOccluder(COcclusionBuffer &Buffer) const
+{
+	const CProceduralMesh *pMesh = m_pOwnerMesh;
+	const double Radius = pMesh->m_pBody->m_RenderParams.m_Radius;
+	const Quat &Orientation = pMesh->m_pBody->m_SimParams.m_Orientation;
+	const int Samples = STileOccluder::SAMPLES;
+	const double CellSize = std::ldexp(2.0, -m_Level) / STileOccluder::CELLS;
+
+	glm::vec3 aPoints[Samples * Samples];
+	for(int y = 0; y < Samples; ++y)
 	{
-		if(m_VAO != 0 && m_NumIndices > 0)
+		for(int x = 0; x < Samples; ++x)
 		{
-			Shader.SetMat4("uModel", NodeModel);
-			glBindVertexArray(m_VAO);
-			glDrawElements(GL_TRIANGLES, m_NumIndices, GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
+			const Vec3 Dir = TileDirection(m_Face, -1.0 + ((double)(m_aTile[0] * STileOccluder::CELLS) + x) * CellSize, -1.0 + ((double)(m_aTile[1] * STileOccluder::CELLS) + y) * CellSize);
+			const Vec3 Point = Dir * (Radius + (double)m_Occluder.m_aElevation[y * Samples + x]);
+			aPoints[y * Samples + x] = (glm::vec3)Orientation.RotateVector(Point - pMesh->m_LodCamPos);
 		}
 	}
-	else
+	for(int y = 0; y < STileOccluder::CELLS; ++y)
 	{
-		bool bChildrenReady = true;
-		for(int i = 0; i < 8; ++i)
+		for(int x = 0; x < STileOccluder::CELLS; ++x)
 		{
-			if(m_pChildren[i] && m_pChildren[i]->m_bIsLeaf && m_pChildren[i]->m_VAO == 0 && !m_pChildren[i]->m_bGenerationAttempted)
-			{
-				bChildrenReady = false;
-				break;
-			}
+			const glm::vec3 *p = &aPoints[y * Samples + x];
+			Buffer.DrawTriangle(p[0], p[1], p[Samples + 1]);
+			Buffer.DrawTriangle(p[0], p[Samples + 1], p[Samples]);
 		}
+	}
+}
 
-		if(bChildrenReady)
+bool COctreeNode::IsOccluded(const COcclusionBuffer &Buffer) const
+{
+	const Quat &Orientation = m_pOwnerMesh->m_pBody->m_SimParams.m_Orientation;
+	glm::vec3 aCorners[8];
+	for(int i = 0; i < 8; ++i)
+	{
+		const Vec3 Corner = m_BoundsCenter + Vec3((i & 1) ? m_BoundsHalfSize.x : -m_BoundsHalfSize.x, (i & 2) ? m_BoundsHalfSize.y : -m_BoundsHalfSize.y,
+			(i & 4) ? m_BoundsHalfSize.z : -m_BoundsHalfSize.z);
+		aCorners[i] = (glm::vec3)Orientation.RotateVector(Corner - m_pOwnerMesh->m_LodCamPos);
+	}
+	return Buffer.IsOccluded(aCorners);
+}
+
+void COctreeNode::DrawMesh(CShader &Shader, const glm::mat4 &Model)
+{
+	if(m_VAO == 0 || m_NumIndices == 0)
+		return;
+
+	GLsizei aCounts[7];
+	const void *apOffsets[7];
+	GLsizei DrawCount = 0;
+	if(m_Layout.m_NumRegularIndices > 0)
+	{
+		aCounts[DrawCount] = m_Layout.m_NumRegularIndices;
+		apOffsets[DrawCount++] = (const void *)0;
+	}
+	for(int Face = 0; Face < 6; ++Face)
+	{
+		if(m_Layout.m_aTransitionCount[Face] > 0 && HasFinerNeighbour(Face))
 		{
-			for(int i = 0; i < 8; ++i)
-				if(m_pChildren[i])
-					m_pChildren[i]->Render(Shader, CameraAbsolutePos, PlanetAbsolutePos, PlanetOrientation);
+			aCounts[DrawCount] = m_Layout.m_aTransitionCount[Face];
+			apOffsets[DrawCount++] = (const void *)(size_t)(m_Layout.m_aTransitionFirst[Face] * (m_IndexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int)));
 		}
-		else
+	}
+	if(DrawCount == 0)
+		return;
+
+	++m_pOwnerMesh->m_NumDrawnMeshes;
+	Shader.SetMat4("uModel", Model);
+	Shader.SetFloat("uPositionScale", m_Layout.m_PositionScale);
+	Shader.SetVec3("uPositionOffset", m_Layout.m_PositionOffset);
+	glBindVertexArray(m_VAO);
+	glMultiDrawElements(GL_TRIANGLES, aCounts, m_IndexType, apOffsets, DrawCount);
+	glBindVertexArray(0);
+}
+
+bool COctreeNode::AreChildrenReady() const
+{
+	for(int i = 0; i < GetNumChildren(); ++i)
+	{
+		const COctreeNode &Child = GetChild(i);
+		if(Child.IsLeaf() && Child.m_VAO == 0 && !Child.m_bGenerationAttempted)
+			return false;
+	}
+	return true;
+}
+
+COctreeNode *COctreeNode::FindNeighbour(int Face, bool bDrawn) const
+{
+	if(IsTile())
+		return FindTileNeighbour(Face, bDrawn);
+	if(m_pOwnerMesh->m_RootNode == CProceduralMesh::NO_NODE)
+		return nullptr;
+	COctreeNode *pNode = &m_pOwnerMesh->GetNode(m_pOwnerMesh->m_RootNode);
+
+	// Center of the same sized node across the face
+	double aTarget[3] = {m_Center.x, m_Center.y, m_Center.z};
+	aTarget[Face / 2] += (Face & 1) ? m_Size : -m_Size;
+	const double RootHalf = pNode->m_Size * 0.5;
+	if(std::abs(aTarget[0] - pNode->m_Center.x) > RootHalf || std::abs(aTarget[1] - pNode->m_Center.y) > RootHalf || std::abs(aTarget[2] - pNode->m_Center.z) > RootHalf)
+		return nullptr;
+
+	// Child order of Subdivide, by the signs of x and y
+	const int aaChildIndex[2][2] = {{0, 3}, {1, 2}};
+	while(pNode->m_Level < m_Level && !pNode->IsLeaf() && (!bDrawn || pNode->AreChildrenReady()))
+	{
+		const int x = aTarget[0] > pNode->m_Center.x, y = aTarget[1] > pNode->m_Center.y, z = aTarget[2] > pNode->m_Center.z;
+		pNode = &pNode->GetChild(aaChildIndex[x][y] + z * 4);
+	}
+	return pNode;
+}
+
+COctreeNode *COctreeNode::FindTileNeighbour(int Face, bool bDrawn) const
+{
+	// The shell has nothing above or below
+	if(Face >= 4)
+		return nullptr;
+
+	const int Axis = Face / 2;
+	const int64_t TileCount = (int64_t)1 << m_Level;
+	int NeighbourFace = m_Face;
+	int64_t aNeighbour[2] = {m_aTile[0], m_aTile[1]};
+	aNeighbour[Axis] += (Face & 1) ? 1 : -1;
+	if(aNeighbour[Axis] < 0 || aNeighbour[Axis] >= TileCount)
+	{
+		// Across the cube edge, the tile of the same level at a point just past it
+		const double TileSize = std::ldexp(2.0, -m_Level);
+		double at[2] = {-1.0 + ((double)m_aTile[0] + 0.5) * TileSize, -1.0 + ((double)m_aTile[1] + 0.5) * TileSize};
+		at[Axis] = (Face & 1) ? 1.0 + TileSize / 16.0 : -1.0 - TileSize / 16.0;
+		double u, v;
+		DirectionToCubeFace(TileDirection(m_Face, at[0], at[1]), NeighbourFace, u, v);
+		const double aUnwarped[2] = {std::atan(u) * 4.0 / PI, std::atan(v) * 4.0 / PI};
+		for(int i = 0; i < 2; ++i)
+			aNeighbour[i] = std::clamp((int64_t)std::floor((aUnwarped[i] + 1.0) / TileSize), (int64_t)0, TileCount - 1);
+	}
+
+	// Child order of Subdivide, by the bits of the tile coordinates
+	COctreeNode *pNode = &m_pOwnerMesh->GetNode(m_pOwnerMesh->m_RootNode + NeighbourFace);
+	while(pNode->m_Level < m_Level && !pNode->IsLeaf() && (!bDrawn || pNode->AreChildrenReady()))
+	{
+		const int Shift = m_Level - pNode->m_Level - 1;
+		pNode = &pNode->GetChild((int)((aNeighbour[0] >> Shift) & 1) + (int)((aNeighbour[1] >> Shift) & 1) * 2);
+	}
+	return pNode;
+}
+
+bool COctreeNode::HasFinerNeighbour(int Face) const
+{
+	// A leaf or a node still drawn by itself covers the neighbour at a coarser level
+	const COctreeNode *pNeighbour = FindNeighbour(Face, true);
+	return pNeighbour && pNeighbour->m_Level == m_Level && !pNeighbour->IsLeaf() && pNeighbour->AreChildrenReady();
+}
+
+bool COctreeNode::PrepareSubdivide()
+{
+	CProceduralMesh *pMesh = m_pOwnerMesh;
+	bool bBalanced = true;
+	for(int Face = 0; Face < 6; ++Face)
+	{
+		// Regions out of view are not drawn, they catch up with their own LOD once they come into view
+		COctreeNode *pNeighbour = FindNeighbour(Face, true);
+		if(!pNeighbour || pNeighbour->m_Level == m_Level || pNeighbour->m_bLodCulled)
+			continue;
+		if(pNeighbour->IsLeaf())
 		{
-			if(m_VAO != 0 && m_NumIndices > 0)
+			// Nothing to match across from a coarser node without a surface
+			if(pNeighbour->m_VAO == 0 && pNeighbour->m_bGenerationAttempted)
+				continue;
+			if(pNeighbour->m_VAO != 0 && pNeighbour->CanChangeLod() && pNeighbour->PrepareSubdivide())
+				pNeighbour->Subdivide();
+		}
+
+		// Only drawn at the finer level once all of its children have a mesh, also the ones out of view, and it must not merge meanwhile
+		if(!pNeighbour->IsLeaf())
+		{
+			pNeighbour->m_LastLodChange = pMesh->m_Time;
+			for(int i = 0; i < pNeighbour->GetNumChildren(); ++i)
 			{
-				Shader.SetMat4("uModel", NodeModel);
-				glBindVertexArray(m_VAO);
-				glDrawElements(GL_TRIANGLES, m_NumIndices, GL_UNSIGNED_INT, 0);
-				glBindVertexArray(0);
+				COctreeNode &Child = pNeighbour->GetChild(i);
+				if(Child.IsLeaf() && Child.m_VAO == 0 && !Child.m_bGenerationAttempted && !Child.m_bIsGenerating)
+				{
+					Child.m_bIsGenerating = true;
+					Child.m_bBalanceRequest = true;
+					pMesh->AddToGenerationQueue(Child.m_Index, std::max(0.1, GetDistanceToBox(pMesh->m_LodCamPos, Child.m_BoundsCenter, Child.m_BoundsHalfSize)));
+				}
 			}
 		}
+		bBalanced = false;
 	}
+	return bBalanced;
+}
+
+bool COctreeNode::CanMerge() const
+{
+	for(int Face = 0; Face < 6; ++Face)
+	{
+		const COctreeNode *pNeighbour = FindNeighbour(Face, false);
+		if(!pNeighbour || pNeighbour->m_Level != m_Level || pNeighbour->IsLeaf())
+			continue;
+		for(int i = 0; i < pNeighbour->GetNumChildren(); ++i)
+		{
+			if(!pNeighbour->GetChild(i).IsLeaf())
+				return false;
+		}
+	}
+	return true;
 }
 
 void COctreeNode::Subdivide()
 {
-	if(!m_bIsLeaf)
+	if(!IsLeaf())
 		return;
 
-	m_bIsLeaf = false;
+	// The block may come from a new page, which does not move this node
+	const uint32_t First = m_pOwnerMesh->AllocateBlock(GetNumChildren());
+	m_FirstChild = First;
+	m_LastLodChange = m_pOwnerMesh->m_Time;
 
-	double newSize = m_Size * 0.5;
-	double offset = m_Size * 0.25;
+	if(IsTile())
+	{
+		// The radial range of the parent bounds the finer surfaces as well
+		for(int i = 0; i < 4; ++i)
+			GetChild(i).InitTile(m_pOwnerMesh, First + i, m_Index, m_Face, m_aTile[0] * 2 + (i & 1), m_aTile[1] * 2 + (i >> 1), m_Level + 1, m_VoxelResolution,
+				m_aElevationRange[0], m_aElevationRange[1]);
+	}
+	else
+	{
+		double newSize = m_Size * 0.5;
+		double offset = m_Size * 0.25;
+
+		const Vec3 aOffsets[8] = {
+			Vec3(-offset, -offset, -offset), // ---
+			Vec3(+offset, -offset, -offset), // +--
+			Vec3(+offset, +offset, -offset), // ++-
+			Vec3(-offset, +offset, -offset), // -+-
+			Vec3(-offset, -offset, +offset), // --+
+			Vec3(+offset, -offset, +offset), // +-+
+			Vec3(+offset, +offset, +offset), // +++
+			Vec3(-offset, +offset, +offset), // -++
+		};
+		for(int i = 0; i < 8; ++i)
+		{
+			// The surfaces of the finer levels stay within the bounds of this mesh, a child outside of them has none
+			COctreeNode &Child = GetChild(i);
+			Child.Init(m_pOwnerMesh, First + i, m_Index, m_Center + aOffsets[i], newSize, m_Level + 1, m_VoxelResolution);
+			Child.m_aElevationRange[0] = m_aElevationRange[0];
+			Child.m_aElevationRange[1] = m_aElevationRange[1];
+			if(!Child.ClipBounds(m_BoundsCenter - m_BoundsHalfSize, m_BoundsCenter + m_BoundsHalfSize))
+				Child.m_bGenerationAttempted = true;
+		}
+	}
 
-	m_pChildren[0] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(-offset, -offset, -offset), newSize, m_Level + 1, m_VoxelResolution); // ---
-	m_pChildren[1] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(+offset, -offset, -offset), newSize, m_Level + 1, m_VoxelResolution); // +--
-	m_pChildren[2] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(+offset, +offset, -offset), newSize, m_Level + 1, m_VoxelResolution); // ++-
-	m_pChildren[3] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(-offset, +offset, -offset), newSize, m_Level + 1, m_VoxelResolution); // -+-
-	m_pChildren[4] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(-offset, -offset, +offset), newSize, m_Level + 1, m_VoxelResolution); // --+
-	m_pChildren[5] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(+offset, -offset, +offset), newSize, m_Level + 1, m_VoxelResolution); // +-+
-	m_pChildren[6] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(+offset, +offset, +offset), newSize, m_Level + 1, m_VoxelResolution); // +++
-	m_pChildren[7] = std::make_shared<COctreeNode>(m_pOwnerMesh, shared_from_this(), m_Center + Vec3(-offset, +offset, +offset), newSize, m_Level + 1, m_VoxelResolution); // -++
+	// Regions this node was split into before come back without generating
+	for(int i = 0; i < GetNumChildren(); ++i)
+		m_pOwnerMesh->RestoreCachedMesh(GetChild(i));
 }
 
 void COctreeNode::Merge()
 {
-	if(m_bIsLeaf)
+	if(IsLeaf())
 		return;
 
-	for(int i = 0; i < 8; ++i)
-		m_pChildren[i] = nullptr;
-	m_bIsLeaf = true;
+	m_pOwnerMesh->FreeBlock(m_FirstChild, GetNumChildren());
+	m_FirstChild = CProceduralMesh::NO_NODE;
+	m_LastLodChange = m_pOwnerMesh->m_Time;
 
 	if(m_VAO == 0 && !m_bIsGenerating)
 	{
 		m_bIsGenerating = true;
 		m_bGenerationAttempted = false;
-		m_bHasGeneratedData = false;
-		m_pOwnerMesh->AddToGenerationQueue(shared_from_this(), 0.0); // Merge fallback
+		m_pOwnerMesh->AddToGenerationQueue(m_Index, 0.0); // Merge fallback
 	}
 }
@@ -4,27 +4,167 @@
 #include <GL/glew.h>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <glm/glm.hpp>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "../sim/body.h"
 #include "camera.h"
+#include "occlusion.h"
 #include "shader.h"
+#include "terrain/heightcache.h"
+#include "terrain/samplecache.h"
 #include "terrain/terrain.h"
 
+// Vertex while a mesh is built, relative to the node center
 struct SProceduralVertex
 {
 	glm::vec3 position;
 	glm::vec3 normal;
-	glm::vec2 texCoord;
 	glm::vec4 color_data;
 };
 
+// Vertex as uploaded, decoded in vert_body.glsl
+struct SPackedVertex
+{
+	uint16_t m_aPosition[4]; // on a lattice aligned to the voxel grid of the node, the last one is padding
+	int16_t m_aNormal[2]; // octahedral
+	uint16_t m_aColorData[4]; // half floats
+};
+
+// How to draw a packed chunk mesh
+struct SMeshLayout
+{
+	// The regular triangles come first, followed by the transition triangles of each face
+	unsigned int m_NumRegularIndices = 0;
+	unsigned int m_aTransitionFirst[6] = {};
+	unsigned int m_aTransitionCount[6] = {};
+	// Packed positions decode to Position * m_PositionScale + m_PositionOffset relative to the chunk center
+	float m_PositionScale = 1.0f;
+	glm::vec3 m_PositionOffset = glm::vec3(0.0f);
+};
+
+// Coarse grid across a cube-sphere tile that stays below its mesh, the occlusion culling draws it in place of the mesh
+struct STileOccluder
+{
+	static const int CELLS = 4;
+	static const int SAMPLES = CELLS + 1;
+	bool m_bValid = false;
+	float m_aElevation[SAMPLES * SAMPLES]; // relative to the planet radius
+};
+
+// Packed mesh of a chunk between generation and upload, the storage is recycled through CProceduralMesh
+struct SMeshData
+{
+	std::vector<SPackedVertex> m_vVertices;
+	std::vector<uint16_t> m_vShortIndices;
+	std::vector<unsigned int> m_vIndices; // instead of m_vShortIndices when the vertices do not fit 16 bit
+	SMeshLayout m_Layout;
+	// Box and radial range, relative to the planet radius, of the vertices. Grown by how far the surfaces of the finer
+	// levels can be off, so they bound the whole subtree. Only set if there are any.
+	Vec3 m_BoundsMin, m_BoundsMax;
+	double m_MinElevation = 0.0, m_MaxElevation = 0.0;
+	STileOccluder m_Occluder;
+};
+
+// Surface nets leave small cracks where the LOD changes and along the cube edges of the tiles,
+// so only BenchmarkMeshers uses them
+enum class EMesher
+{
+	MARCHING_CUBES,
+	SURFACE_NETS,
+};
+
+// Region a chunk mesh is generated for, the workers only get this and never touch the octree
+struct SChunkDesc
+{
+	Vec3 m_Center;
+	double m_Size;
+	int m_Level;
+	int m_VoxelResolution;
+	// Cube-sphere tiles: the cube face, -1 for octree chunks, and the tile on it at m_Level
+	int m_Face = -1;
+	int64_t m_aTile[2] = {0, 0};
+	// Generation settings of the mesh when the chunk was queued, the UI changes the live ones while workers run
+	EMesher m_Mesher = EMesher::MARCHING_CUBES;
+	bool m_bGridNormals = true;
+	bool m_bHeightCache = true;
+	bool m_bSampleCache = true;
+	bool m_bOctaveCulling = true;
+};
+
+// Identifies the region of a chunk mesh within one body. Octree nodes use their cube on the lattice of their level,
+// tiles their face and their position on it.
+struct SMeshKey
+{
+	int m_Face;
+	int m_Level;
+	int64_t m_aCoord[3];
+
+	bool operator==(const SMeshKey &Other) const
+	{
+		return m_Face == Other.m_Face && m_Level == Other.m_Level && m_aCoord[0] == Other.m_aCoord[0] && m_aCoord[1] == Other.m_aCoord[1] &&
+		       m_aCoord[2] == Other.m_aCoord[2];
+	}
+};
+
+struct SMeshKeyHash
+{
+	size_t operator()(const SMeshKey &Key) const
+	{
+		uint64_t h = (uint64_t)Key.m_aCoord[0] * 0x9E3779B97F4A7C15ull;
+		h ^= (uint64_t)Key.m_aCoord[1] * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+		h ^= (uint64_t)Key.m_aCoord[2] * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+		h ^= ((uint64_t)(uint32_t)Key.m_Face << 32 | (uint32_t)Key.m_Level) * 0x27D4EB2F165667C5ull + (h << 6) + (h >> 2);
+		return (size_t)h;
+	}
+};
+
+// Nodes live in pooled pages and are addressed by index. A slot's generation changes whenever it is freed,
+// so a handle held by a task tells whether the node it was made for still exists.
+struct SNodeHandle
+{
+	uint32_t m_Index;
+	uint32_t m_Generation;
+};
+
+// Scratch memory of one generation worker, reused between tasks so generating a chunk does not allocate once the buffers have grown
+struct SGenerationScratch
+{
+	std::vector<float> m_vDensityGrid;
+	std::vector<SProceduralVertex> m_vVertices;
+	std::vector<Vec3> m_vVertexPositions;
+	std::vector<float> m_vVertexElevations;
+	std::vector<unsigned int> m_vIndices;
+	std::vector<STerrainOutput> m_vVertexTerrain;
+
+	// Vertex lookup of the meshers
+	std::vector<unsigned int> m_avXEdges[2], m_avYEdges[2], m_vZEdges;
+	std::vector<unsigned int> m_avFaceEdges[6];
+	std::vector<unsigned int> m_vCellVertices;
+
+	// Cube-sphere tiles, per column of the grid
+	std::vector<Vec3> m_vColumnDirections;
+	std::vector<float> m_vColumnHeights;
+	std::vector<glm::vec2> m_vOccluderCoords; // of the vertices, in occluder cells
+
+	// Transitions
+	std::vector<int> m_vFineSlots;
+	std::vector<Vec3> m_vFinePositions;
+	std::vector<float> m_vFineDensities;
+	std::vector<int> m_vActiveSquares;
+	std::vector<unsigned int> m_vFineEdgeVertices, m_vCornerVertices;
+	std::vector<int> m_vLoop;
+};
+
 class COctreeNode;
 
 class CProceduralMesh
@@ -40,10 +180,31 @@ public:
 
 	void Render(const CCamera &Camera, const SBody *pLightBody, bool bIsShadowPass, double Time = 0.0);
 	void RenderDebug(const CCamera &Camera);
+	// Meshes the current leaves with every mesher and prints the timings and sizes, the nodes keep marching cubes
+	void BenchmarkMeshers();
+
+	// Generates the mesh of a chunk, safe to call from any thread. Returns false if *pCancel got set on the way,
+	// the mesh is incomplete then.
+	bool GenerateMesh(const SChunkDesc &Chunk, SGenerationScratch &Scratch, SMeshData &Mesh, const std::atomic<bool> *pCancel = nullptr);
+
+	// Hands out recycled storage to a mesh that has none yet, and takes it back after the upload
+	void AcquireMeshData(SMeshData &Data);
+	void RecycleMeshData(SMeshData &Data);
 
 	void Destroy();
 
-	void AddToGenerationQueue(std::shared_ptr<COctreeNode> pNode, double distToCam);
+	// Takes over the mesh of a node that is freed, and gives it back to a node created for the same region
+	void StoreCachedMesh(COctreeNode &Node);
+	bool RestoreCachedMesh(COctreeNode &Node);
+	// Moves the least recently used meshes from the GPU to the CPU and drops them from there, to stay within the budgets.
+	// The GPU copies into a staging buffer first, which is read once its fence has passed in a later frame.
+	void TrimMeshCache();
+	void ClearMeshCache();
+
+	void AddToGenerationQueue(uint32_t Node, double distToCam, bool bPrefetch = false);
+	// Once per frame after the LOD pass: drops the tasks whose node no longer wants its mesh and reorders the rest
+	// by their current distance to the camera
+	void RefreshGenerationQueue();
 	void CheckApplyQueue();
 	void GenerationWorkerLoop();
 
@@ -58,42 +219,192 @@ public:
 	// Tunable LOD settings
 	float m_SplitMultiplier = 0.2f;
 	float m_MergeMultiplier = 0.1f;
+	// Time per frame for re-evaluating the LOD of nodes, the others act on their last decision
+	float m_LodBudget = 1.0f; // in ms
+	// A node does not merge right after it split or split right after it merged
+	float m_LodHysteresis = 0.5f; // in seconds
+	int m_NumLodEvaluations = 0; // last frame
+	// Requests the meshes the camera will need in m_PrefetchTime seconds if it keeps its velocity in the body frame,
+	// which includes the rotation of the body under it. They queue behind every regular task.
+	bool m_bPrefetch = true;
+	float m_PrefetchTime = 2.0f; // in seconds
+	// Since the last reset: prefetched meshes that were ready when their node was needed, prefetches still queued
+	// by then, nodes needed without a prefetch while it was extrapolating, and prefetched meshes freed unused
+	struct SPrefetchStats
+	{
+		int m_Hits = 0;
+		int m_Late = 0;
+		int m_Misses = 0;
+		int m_Wasted = 0;
+	};
+	SPrefetchStats m_PrefetchStats;
+	// Generation for nodes that stopped wanting their mesh: tasks dropped from the queue, stopped while running,
+	// and meshes thrown away when done, with the time spent on the latter two
+	std::atomic<int> m_NumDroppedTasks{0}, m_NumAbortedTasks{0}, m_NumDiscardedMeshes{0};
+	std::atomic<int64_t> m_WastedMicroseconds{0};
+	// Meshes of freed nodes are kept for when the region gets split again. They keep their buffers up to the GPU budget,
+	// older ones only their packed data up to the CPU budget.
+	bool m_bMeshCache = true;
+	bool m_bMeshCacheGPU = true;
+	float m_MeshCacheGPUBudget = 64.0f; // in MB
+	float m_MeshCacheCPUBudget = 128.0f; // in MB
+	int m_MeshCacheHits = 0, m_MeshCacheMisses = 0;
+	size_t m_MeshCacheGPUBytes = 0, m_MeshCacheCPUBytes = 0;
+	// Before the main pass the occluders of the nearest drawn tiles are rasterized into m_OcclusionBuffer, nodes
+	// entirely behind them are not drawn. Only tiles have occluders, octree chunks are never culled this way.
+	bool m_bOcclusionCulling = true;
+	int m_OcclusionWidth = 256; // in pixels
+	int m_MaxOccluders = 64;
+	int m_NumOccluders = 0, m_NumOccludedNodes = 0, m_NumDrawnMeshes = 0; // last frame
+	float m_OcclusionTime = 0.0f; // in ms, last frame
+	COcclusionBuffer m_OcclusionBuffer;
 	bool m_bVisualizeOctree = false;
+	// Vertex normals from the sampled grid instead of six extra terrain evaluations per vertex
+	bool m_bGridNormals = true;
+	// Sample terrestrial bodies through m_HeightCache
+	bool m_bHeightCache = true;
+	// Skip noise octaves finer than the voxel size of a node
+	bool m_bOctaveCulling = true;
+	// Reuse grid densities between nodes through m_SampleCache, for bodies without the height cache
+	bool m_bSampleCache = true;
+	// Terrestrial bodies only: six quadtrees of tiles over a cube-sphere instead of the octree, each tile only
+	// meshes the radial range its surface spans
+	bool m_bCubeSphere = false;
+	int GetNumNodes() const { return m_NumLiveNodes; }
 
 	SBody *m_pBody = nullptr;
 	CShader m_Shader;
-	std::shared_ptr<COctreeNode> m_pRootNode;
+
+	// Camera motion relative to the body, summed over all frames. The difference to the values at the last evaluation
+	// of a node bounds how much its LOD tests can have changed since, see COctreeNode::NeedsLodEvaluation.
+	double m_LodTravel = 0.0; // path length of the camera in the body frame
+	double m_LodTurn = 0.0; // change of the body to view rotation, Frobenius norm
+	uint32_t m_LodEpoch = 0; // bumped when every decision is stale
+	Vec3 m_LodCamPos; // camera in the body frame
+	Vec3 m_LodCamVelocity; // smoothed over the last frames
+	Vec3 m_PrefetchCamPos; // where the camera is extrapolated to, m_LodCamPos while the prefetch is off
+	bool m_bPrefetchActive = false;
+	double m_LodUpdateTime = 0.0;
+	glm::mat3 m_LodViewRotation;
+	glm::mat4 m_LodProjection;
+	bool m_bLodFocused = false;
+	bool m_bLodStateValid = false;
+	float m_LodSplitMultiplier = 0.0f, m_LodMergeMultiplier = 0.0f;
+	double m_Time = 0.0; // seconds since construction
+	std::chrono::steady_clock::time_point m_StartTime, m_LodDeadline;
+
+	// Layers of cells sampled around a chunk, they provide the gradients and the neighbour cells at the faces
+	static const int GRID_PADDING = 1;
+
+	// Node pool, the children of a node are allocated as one block of 8 (octree) or 4 (tiles). Only the main thread touches the nodes.
+	static const uint32_t NO_NODE = ~0u;
+	static const uint32_t NODE_PAGE_SIZE = 512; // nodes, a multiple of 8
+	std::vector<std::unique_ptr<COctreeNode[]>> m_vpNodePages;
+	std::vector<uint32_t> m_avFreeBlocks[2]; // blocks of 4 and of 8
+	uint32_t m_NumNodes = 0;
+	int m_NumLiveNodes = 0;
+	// The octree root, or the first of the six face roots of the cube-sphere
+	uint32_t m_RootNode = NO_NODE;
+	bool m_bTreeIsCubeSphere = false;
+	double m_RootSize = 0.0;
+	int m_VoxelResolution = 0;
+	double m_OccluderRadius = 0.0; // the surface is nowhere below this, it hides what is behind its horizon
+
+	COctreeNode &GetNode(uint32_t Index) { return m_vpNodePages[Index / NODE_PAGE_SIZE][Index % NODE_PAGE_SIZE]; }
+	const COctreeNode &GetNode(uint32_t Index) const { return m_vpNodePages[Index / NODE_PAGE_SIZE][Index % NODE_PAGE_SIZE]; }
+	uint32_t AllocateBlock(uint32_t Size);
+	void FreeBlock(uint32_t First, uint32_t Size);
+	bool IsAlive(const SNodeHandle &Handle) const;
+	int GetNumRoots() const { return m_bTreeIsCubeSphere ? 6 : 1; }
+	// Frees the current tree and starts the one m_bCubeSphere asks for
+	void BuildTree();
 
 	CTerrainGenerator m_TerrainGenerator;
+	CHeightCache m_HeightCache;
+	CSampleCache m_SampleCache;
 
 	// Priority Queue Task
 	struct SGenTask
 	{
-		std::shared_ptr<COctreeNode> m_pNode;
+		SNodeHandle m_Node;
+		SChunkDesc m_Chunk;
 		double m_Priority; // Distance to camera
+		bool m_bPrefetch = false;
+		std::shared_ptr<std::atomic<bool>> m_pCancel; // shared with the node, set once it no longer wants the mesh
 
 		// we want smallest distance at top, so operator< returns true if lhs has HIGHER distance
 		bool operator<(const SGenTask &other) const
 		{
+			if(m_bPrefetch != other.m_bPrefetch)
+				return m_bPrefetch;
 			return m_Priority > other.m_Priority;
 		}
 	};
 
-	std::priority_queue<SGenTask> m_GenerationQueue;
+	// Heap, a plain vector so queued tasks can be found again
+	std::vector<SGenTask> m_vGenerationQueue;
 	std::mutex m_GenQueueMutex;
 	std::condition_variable m_GenQueueCV;
 
-	std::queue<std::shared_ptr<COctreeNode>> m_ApplyQueue;
+	struct SGenResult
+	{
+		SNodeHandle m_Node;
+		std::shared_ptr<std::atomic<bool>> m_pCancel;
+		SMeshData m_Mesh;
+		int64_t m_Microseconds = 0;
+	};
+
+	std::queue<SGenResult> m_ApplyQueue;
 	std::mutex m_ApplyQueueMutex;
 	std::condition_variable m_ApplyQueueCV;
 	const size_t m_MaxApplyQueueSize = 100;
 
+	std::vector<SMeshData> m_vMeshDataPool;
+	std::mutex m_MeshDataPoolMutex;
+
+	struct SCachedMesh
+	{
+		SMeshKey m_Key;
+		// While on the GPU, otherwise m_Mesh holds the packed data. The layout and the elevations are always in m_Mesh.
+		GLuint m_VAO = 0, m_VBO = 0, m_EBO = 0;
+		unsigned int m_NumVertices = 0, m_NumIndices = 0;
+		GLenum m_IndexType = GL_UNSIGNED_INT;
+		SMeshData m_Mesh;
+		size_t m_Bytes = 0;
+		// Copy of the buffers on its way to the CPU, the buffers above stay usable until it is read
+		GLuint m_ReadbackBuffer = 0;
+		GLsync m_ReadbackFence = nullptr;
+	};
+	// Most recently stored first, only the main thread uses it
+	std::list<SCachedMesh> m_MeshCache;
+	std::unordered_map<SMeshKey, std::list<SCachedMesh>::iterator, SMeshKeyHash> m_MeshCacheIndex;
+	int m_NumMeshReadbacks = 0;
+	// Of the settings that change the generated meshes, the cache is cleared when it changes
+	int m_MeshCacheSignature = -1;
+	int GetMeshSignature() const { return m_bGridNormals | m_bHeightCache << 1 | m_bOctaveCulling << 2; }
+
 	std::vector<std::thread> m_vWorkerThreads;
 	std::atomic<bool> m_bRunWorker;
 
 private:
 	void InitDebug();
 	void InitGasGiantGeometry();
+	// False if the box lies completely above or below the terrain surface. The shell test is exact, the coarse samples
+	// rely on the estimated slope of CTerrainGenerator::GetElevationSlopeBound.
+	bool CanContainSurface(const Vec3 &BoxMin, double BoxSize, double PlanetRadius, double Footprint);
+	// Biome attributes for the generated vertices, then packs the mesh for upload
+	void FinishMesh(const SChunkDesc &Chunk, SGenerationScratch &Scratch, double PlanetRadius, double Footprint, SMeshData &Mesh);
+	// Rasterizes the occluders of the nearest drawn tiles for the next Render
+	void UpdateOcclusion(const CCamera &Camera);
+	std::vector<std::pair<double, uint32_t>> m_vOccluderCandidates; // distance and node
+	bool m_bOcclusionActive = false;
+	// Adds or subtracts the entry to the byte counts of the tier it is in
+	void AccountCachedMesh(const SCachedMesh &Entry, bool bAdd);
+	std::list<SCachedMesh>::iterator EraseCachedMesh(std::list<SCachedMesh>::iterator It, bool bDeleteBuffers);
+	void StartMeshReadback(SCachedMesh &Entry);
+	// Moves the entry to the CPU tier, its fence must have passed
+	void FinishMeshReadback(SCachedMesh &Entry);
+	void CancelMeshReadback(SCachedMesh &Entry);
 	CShader m_DebugShader;
 	GLuint m_DebugCubeVAO = 0, m_DebugCubeVBO = 0, m_DebugCubeEBO = 0;
 
@@ -102,18 +413,34 @@ private:
 	unsigned int m_ProxyIndexCount = 0;
 };
 
-class COctreeNode : public std::enable_shared_from_this<COctreeNode>
+// Node of the octree, or a tile of the cube-sphere quadtrees if m_Face is set
+class COctreeNode
 {
 public:
 	static const int MAX_LOD_LEVEL = 50;
+	static const int MAX_TILE_LEVEL = 40; // keeps the tile lattice exact in doubles
 
-	COctreeNode(CProceduralMesh *pOwnerMesh, std::weak_ptr<COctreeNode> pParent, Vec3 center, double size, int level, int voxelResolution);
-	~COctreeNode();
+	void Init(CProceduralMesh *pOwnerMesh, uint32_t Index, uint32_t Parent, Vec3 center, double size, int level, int voxelResolution);
+	// The elevation range bounds the tile until its mesh measures it
+	void InitTile(CProceduralMesh *pOwnerMesh, uint32_t Index, uint32_t Parent, int face, int64_t tileU, int64_t tileV, int level, int voxelResolution, double MinElevation, double MaxElevation);
+	// Frees the GPU buffers and invalidates the handles to the node
+	void Release();
 
 	void Update(CCamera &Camera);
-	void Render(CShader &Shader, const Vec3 &CameraAbsolutePos, const Vec3 &PlanetAbsolutePos, const Quat &PlanetOrientation);
-	void GenerateMesh();
-	void ApplyMeshBuffers();
+	// bCull skips the subtrees outside the view of the last update
+	void Render(CShader &Shader, const Vec3 &CameraAbsolutePos, const Vec3 &PlanetAbsolutePos, const Quat &PlanetOrientation, bool bCull);
+	void ApplyMeshBuffers(const SMeshData &Mesh);
+
+	bool IsLeaf() const { return m_FirstChild == CProceduralMesh::NO_NODE; }
+	SNodeHandle GetHandle() const { return {m_Index, m_Generation}; }
+	SChunkDesc GetChunkDesc() const
+	{
+		return {m_Center, m_Size, m_Level, m_VoxelResolution, m_Face, {m_aTile[0], m_aTile[1]}, EMesher::MARCHING_CUBES, m_pOwnerMesh->m_bGridNormals,
+			m_pOwnerMesh->m_bHeightCache, m_pOwnerMesh->m_bSampleCache, m_pOwnerMesh->m_bOctaveCulling};
+	}
+	bool IsTile() const { return m_Face >= 0; }
+	SMeshKey GetMeshKey() const;
+	int GetNumChildren() const { return IsTile() ? 4 : 8; }
 
 	// Friend for debug rendering
 	friend class CProceduralMesh;
@@ -121,27 +448,88 @@ public:
 private:
 	void Subdivide();
 	void Merge();
-
-	CProceduralMesh *m_pOwnerMesh;
-	std::weak_ptr<COctreeNode> m_pParent;
-	std::shared_ptr<COctreeNode> m_pChildren[8];
-
-	bool m_bIsLeaf = true;
-	int m_Level;
-	int m_VoxelResolution;
+	// The transitions only bridge one level, so nodes across a face are kept within one level of each other. A split waits
+	// until the nodes of the same level across every face are drawn, and splits the coarser ones covering their regions.
+	bool PrepareSubdivide();
+	// False while a child of a node of the same level across a face is split
+	bool CanMerge() const;
+	// True if the camera may have moved far enough since the last evaluation to change the decision
+	bool NeedsLodEvaluation() const;
+	void EvaluateLod(const CCamera &Camera);
+	// Stops the queued or running generation of the mesh, the node can request it again later
+	void CancelGeneration();
+	// Queues the meshes of the leaves that would want to split at the extrapolated camera position, and splits
+	// the leaves that already have one
+	void Prefetch();
+	bool CanChangeLod() const { return m_pOwnerMesh->m_Time - m_LastLodChange >= m_pOwnerMesh->m_LodHysteresis; }
+	COctreeNode &GetChild(int i) const { return m_pOwnerMesh->GetNode(m_FirstChild + i); }
+	// False while a child still waits for its mesh, the node is drawn instead of its children then
+	bool AreChildrenReady() const;
+	// Node of the same level across the face, or the coarser one covering its region, null if the face is on the border.
+	// Faces are 2 * axis + (1 for the positive side), for tiles the axes are u, v and the radial one. With bDrawn, stops
+	// at the nodes drawn instead of their children.
+	COctreeNode *FindNeighbour(int Face, bool bDrawn) const;
+	COctreeNode *FindTileNeighbour(int Face, bool bDrawn) const;
+	// True if the region across the face is currently drawn at a finer level
+	bool HasFinerNeighbour(int Face) const;
+	// Box around the tile between the two elevations, for the LOD tests
+	void SetTileBounds(double MinElevation, double MaxElevation);
+	// Narrows the bounds down to the ones measured on the mesh
+	void SetMeshBounds(const SMeshData &Mesh);
+	// Intersects the box with the given one, false if nothing is left
+	bool ClipBounds(const Vec3 &Min, const Vec3 &Max);
+	// False if the bounds are entirely outside the view or behind the horizon of the body
+	bool IsInView(const Vec3 &CamPos, double *pMargin = nullptr) const;
+	// Adds the nodes Render would draw that have an occluder
+	void CollectOccluders(std::vector<std::pair<double, uint32_t>> &vCandidates) const;
+	void DrawOccluder(COcclusionBuffer &Buffer) const;
+	bool IsOccluded(const COcclusionBuffer &Buffer) const;
+	void DrawMesh(CShader &Shader, const glm::mat4 &Model);
+
+	CProceduralMesh *m_pOwnerMesh = nullptr;
+	uint32_t m_Index = CProceduralMesh::NO_NODE;
+	uint32_t m_Parent = CProceduralMesh::NO_NODE;
+	uint32_t m_FirstChild = CProceduralMesh::NO_NODE;
+	uint32_t m_Generation = 0;
+
+	int m_Level = 0;
+	int m_VoxelResolution = 0;
 
 	Vec3 m_Center;
-	double m_Size;
+	double m_Size = 0.0;
+	int m_Face = -1;
+	int64_t m_aTile[2] = {0, 0};
 
-	GLuint m_VAO = 0, m_VBO = 0, m_EBO = 0;
-	unsigned int m_NumIndices = 0;
-
-	std::atomic<bool> m_bIsGenerating;
-	std::atomic<bool> m_bHasGeneratedData;
-	std::atomic<bool> m_bGenerationAttempted;
+	// Box the LOD tests use, within the node cube for the octree. Both it and the radial range relative to the
+	// planet radius start out from the parent and narrow down to the mesh once there is one.
+	Vec3 m_BoundsCenter;
+	Vec3 m_BoundsHalfSize;
+	double m_BoundingRadius = 0.0;
+	double m_aElevationRange[2] = {0.0, 0.0};
 
-	std::vector<SProceduralVertex> m_vGeneratedVertices;
-	std::vector<unsigned int> m_vGeneratedIndices;
+	GLuint m_VAO = 0, m_VBO = 0, m_EBO = 0;
+	unsigned int m_NumVertices = 0, m_NumIndices = 0;
+	GLenum m_IndexType = GL_UNSIGNED_INT;
+	SMeshLayout m_Layout;
+	STileOccluder m_Occluder;
+
+	bool m_bIsGenerating = false;
+	bool m_bGenerationAttempted = false;
+	bool m_bPrefetched = false; // requested by the prefetch and not needed yet
+	bool m_bBalanceRequest = false; // requested for a neighbour to split, kept out of view as well
+	std::shared_ptr<std::atomic<bool>> m_pGenerationCancel; // of the pending task
+
+	// Decision of the last LOD evaluation
+	bool m_bLodCulled = false;
+	bool m_bLodSplit = false;
+	bool m_bLodMerge = false;
+	double m_LodPriority = 0.0;
+	// How far the camera can move before the decision may change, and the state it was taken at
+	double m_LodSlack = -1.0;
+	double m_LodTravel = 0.0, m_LodTurn = 0.0;
+	double m_LodDistance = 0.0;
+	uint32_t m_LodEpoch = 0;
+	double m_LastLodChange = 0.0;
 };
 
 #endif // PROCEDURALMESH_H
@@ -110,6 +110,12 @@ public:
 		glUniform1i(glGetUniformLocation(m_Program, pName), Value);
 	}
 
+	// Set an unsigned integer uniform
+	void SetUInt(const char *pName, unsigned int Value)
+	{
+		glUniform1ui(glGetUniformLocation(m_Program, pName), Value);
+	}
+
 	// Set a boolean uniform
 	void SetBool(const char *pName, bool Value)
 	{
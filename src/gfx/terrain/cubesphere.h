@@ -0,0 +1,33 @@
+#ifndef CUBESPHERE_H
+#define CUBESPHERE_H
+
+#include "../../sim/vmath.h"
+#include <cmath>
+
+// Face = 2 * major axis + (1 if negative), u and v are the two following axes divided by the major one
+inline void DirectionToCubeFace(const Vec3 &Dir, int &Face, double &u, double &v)
+{
+	const double a[3] = {Dir.x, Dir.y, Dir.z};
+	int Axis = 0;
+	if(std::abs(a[1]) > std::abs(a[Axis]))
+		Axis = 1;
+	if(std::abs(a[2]) > std::abs(a[Axis]))
+		Axis = 2;
+
+	const double Major = std::abs(a[Axis]);
+	Face = Axis * 2 + (a[Axis] < 0.0 ? 1 : 0);
+	u = a[(Axis + 1) % 3] / Major;
+	v = a[(Axis + 2) % 3] / Major;
+}
+
+inline Vec3 CubeFaceToDirection(int Face, double u, double v)
+{
+	const int Axis = Face / 2;
+	double a[3];
+	a[Axis] = (Face & 1) ? -1.0 : 1.0;
+	a[(Axis + 1) % 3] = u;
+	a[(Axis + 2) % 3] = v;
+	return Vec3(a[0], a[1], a[2]).normalize();
+}
+
+#endif // CUBESPHERE_H
@@ -0,0 +1,125 @@
+#include "heightcache.h"
+#include "cubesphere.h"
+#include <algorithm>
+#include <cmath>
+
+std::shared_ptr<const CHeightCache::STile> CHeightCache::GetTile(int Face, int Level, int TileU, int TileV, double PlanetRadius, bool bOctaveCulling)
+{
+	const uint64_t Key = ((uint64_t)Face << 61) | ((uint64_t)Level << 56) | ((uint64_t)TileU << 28) | (uint64_t)TileV;
+	{
+		std::lock_guard<std::mutex> Lock(m_Mutex);
+		// Tiles of the other mode have different content under the same key, toggling is rare enough to start over
+		if(bOctaveCulling != m_bOctaveCulling)
+		{
+			m_Tiles.clear();
+			m_TileIndex.clear();
+			m_bOctaveCulling = bOctaveCulling;
+		}
+		auto It = m_TileIndex.find(Key);
+		if(It != m_TileIndex.end())
+		{
+			m_Tiles.splice(m_Tiles.begin(), m_Tiles, It->second);
+			return It->second->m_pTile;
+		}
+	}
+
+	// Built outside the lock, two workers may occasionally build the same tile
+	auto pTile = std::make_shared<STile>();
+	const double Spacing = 2.0 / (double)((uint64_t)TILE_CELLS << Level);
+	std::vector<Vec3> vPositions(TILE_SAMPLES * TILE_SAMPLES);
+	for(int j = 0; j < TILE_SAMPLES; ++j)
+	{
+		for(int i = 0; i < TILE_SAMPLES; ++i)
+		{
+			double u = -1.0 + (double)(TileU * TILE_CELLS + i) * Spacing;
+			double v = -1.0 + (double)(TileV * TILE_CELLS + j) * Spacing;
+			vPositions[i + j * TILE_SAMPLES] = CubeFaceToDirection(Face, u, v) * PlanetRadius;
+		}
+	}
+	std::vector<float> vDensities(vPositions.size());
+	pTile->m_vElevations.resize(vPositions.size());
+	const double Footprint = bOctaveCulling ? Spacing * PlanetRadius : 0.0;
+	m_pGenerator->GetDensities(vPositions.data(), (int)vPositions.size(), PlanetRadius, vDensities.data(), pTile->m_vElevations.data(), Footprint);
+
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+	if(bOctaveCulling != m_bOctaveCulling)
+		return pTile;
+	auto It = m_TileIndex.find(Key);
+	if(It != m_TileIndex.end())
+		return It->second->m_pTile;
+	m_Tiles.push_front({Key, pTile});
+	m_TileIndex.emplace(Key, m_Tiles.begin());
+	while(m_Tiles.size() > m_MaxTiles)
+	{
+		m_TileIndex.erase(m_Tiles.back().m_Key);
+		m_Tiles.pop_back();
+	}
+	return pTile;
+}
+
+void CHeightCache::SampleDensityGrid(const Vec3 &StartCorner, double StepSize, int Res, double PlanetRadius, float *pDensities, double Footprint)
+{
+	// In batches on the stack, the grid is sampled for every chunk
+	const int BatchSize = 256;
+	Vec3 aPositions[BatchSize];
+	const int Count = Res * Res * Res;
+	for(int First = 0; First < Count; First += BatchSize)
+	{
+		const int Num = std::min(BatchSize, Count - First);
+		for(int n = 0; n < Num; ++n)
+		{
+			const int Idx = First + n;
+			const int x = Idx % Res, y = (Idx / Res) % Res, z = Idx / (Res * Res);
+			aPositions[n] = StartCorner + Vec3((double)x * StepSize, (double)y * StepSize, (double)z * StepSize);
+		}
+		GetDensities(aPositions, Num, StepSize, PlanetRadius, pDensities + First, Footprint);
+	}
+}
+
+void CHeightCache::GetDensities(const Vec3 *pPositions, int Count, double StepSize, double PlanetRadius, float *pDensities, double Footprint)
+{
+	// Cache spacing at or below the voxel size, 2 / (TILE_CELLS * 2^Level) <= StepSize / PlanetRadius.
+	// The gnomonic projection only makes the angular spacing smaller away from the face centers.
+	const double MinTiles = 2.0 * PlanetRadius / ((double)TILE_CELLS * StepSize);
+	const int Level = std::clamp((int)std::ceil(std::log2(std::max(MinTiles, 1.0))), 0, MAX_LEVEL);
+	const int TileCount = 1 << Level;
+	const double SamplesPerUnit = (double)(TILE_CELLS * TileCount) / 2.0;
+
+	// Consecutive positions mostly hit the same tile
+	std::shared_ptr<const STile> pTile;
+	int CurFace = -1, CurU = -1, CurV = -1;
+
+	for(int n = 0; n < Count; ++n)
+	{
+		const Vec3 &Pos = pPositions[n];
+		double Dist = Pos.length();
+
+		int Face;
+		double u, v;
+		DirectionToCubeFace(Dist > 0.0 ? Pos : Vec3(1.0, 0.0, 0.0), Face, u, v);
+
+		double gu = (u + 1.0) * SamplesPerUnit;
+		double gv = (v + 1.0) * SamplesPerUnit;
+		int TileU = std::clamp((int)std::floor(gu / TILE_CELLS), 0, TileCount - 1);
+		int TileV = std::clamp((int)std::floor(gv / TILE_CELLS), 0, TileCount - 1);
+		double fu = std::clamp(gu - (double)(TileU * TILE_CELLS), 0.0, (double)TILE_CELLS);
+		double fv = std::clamp(gv - (double)(TileV * TILE_CELLS), 0.0, (double)TILE_CELLS);
+		int i = std::min((int)fu, TILE_CELLS - 1);
+		int j = std::min((int)fv, TILE_CELLS - 1);
+		float tu = (float)(fu - i);
+		float tv = (float)(fv - j);
+
+		if(Face != CurFace || TileU != CurU || TileV != CurV)
+		{
+			pTile = GetTile(Face, Level, TileU, TileV, PlanetRadius, Footprint > 0.0);
+			CurFace = Face;
+			CurU = TileU;
+			CurV = TileV;
+		}
+
+		const float *pElevations = pTile->m_vElevations.data() + i + j * TILE_SAMPLES;
+		float Bottom = pElevations[0] + (pElevations[1] - pElevations[0]) * tu;
+		float Top = pElevations[TILE_SAMPLES] + (pElevations[TILE_SAMPLES + 1] - pElevations[TILE_SAMPLES]) * tu;
+		pDensities[n] = (float)(PlanetRadius - Dist) + Bottom + (Top - Bottom) * tv;
+	}
+}
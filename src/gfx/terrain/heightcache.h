@@ -0,0 +1,57 @@
+#ifndef HEIGHTCACHE_H
+#define HEIGHTCACHE_H
+
+#include "../../sim/vmath.h"
+#include "terrain.h"
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// The elevation only depends on the direction from the planet center. This caches it on a cube-sphere:
+// every face is split into 2^Level x 2^Level tiles of TILE_CELLS^2 cells, and lookups interpolate
+// bilinearly between the cached samples.
+class CHeightCache
+{
+public:
+	static const int TILE_CELLS = 16;
+	static const int TILE_SAMPLES = TILE_CELLS + 1; // neighbouring tiles share their border samples
+	static const int MAX_LEVEL = 24;
+
+	size_t m_MaxTiles = 2048;
+
+	void Init(CTerrainGenerator *pGenerator) { m_pGenerator = pGenerator; }
+
+	// Same layout as CTerrainGenerator::SampleDensityGrid. Only the cache samples are run through the noise, at a
+	// spacing no coarser than StepSize at the surface, each voxel is a lookup plus the radial distance.
+	// With a Footprint above 0 the tiles skip the octaves finer than their own spacing.
+	void SampleDensityGrid(const Vec3 &StartCorner, double StepSize, int Res, double PlanetRadius, float *pDensities, double Footprint = 0.0);
+	// Same for arbitrary positions, sampled as if they were part of a grid with StepSize
+	void GetDensities(const Vec3 *pPositions, int Count, double StepSize, double PlanetRadius, float *pDensities, double Footprint = 0.0);
+
+private:
+	struct STile
+	{
+		std::vector<float> m_vElevations; // TILE_SAMPLES^2, u varies fastest
+	};
+
+	struct SCachedTile
+	{
+		uint64_t m_Key;
+		std::shared_ptr<const STile> m_pTile;
+	};
+
+	CTerrainGenerator *m_pGenerator = nullptr;
+
+	std::mutex m_Mutex;
+	// Most recently used first, the least recently used tiles are evicted
+	std::list<SCachedTile> m_Tiles;
+	std::unordered_map<uint64_t, std::list<SCachedTile>::iterator> m_TileIndex;
+	bool m_bOctaveCulling = false; // of the cached tiles
+
+	std::shared_ptr<const STile> GetTile(int Face, int Level, int TileU, int TileV, double PlanetRadius, bool bOctaveCulling);
+};
+
+#endif // HEIGHTCACHE_H
@@ -0,0 +1,148 @@
+#include "samplecache.h"
+#include <algorithm>
+
+void CSampleCache::Clear()
+{
+	std::lock_guard<std::mutex> Lock(m_Mutex);
+	m_vSlots.clear();
+	m_UseCounter = 0;
+	m_Lookups = 0;
+	m_Hits = 0;
+}
+
+double CSampleCache::GetHitRate() const
+{
+	uint64_t Lookups = m_Lookups;
+	return Lookups > 0 ? (double)m_Hits / (double)Lookups : 0.0;
+}
+
+uint64_t CSampleCache::HashKey(const SKey &Key)
+{
+	uint64_t h = (uint64_t)Key.m_aIndex[0] * 0x9E3779B97F4A7C15ull;
+	h ^= (uint64_t)Key.m_aIndex[1] * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+	h ^= (uint64_t)Key.m_aIndex[2] * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+	h ^= (uint64_t)Key.m_Level * 0x27D4EB2F165667C5ull + (h << 6) + (h >> 2);
+	return h ^ (h >> 29);
+}
+
+CSampleCache::SSlot *CSampleCache::FindSlot(const SKey &Key)
+{
+	const size_t Mask = m_vSlots.size() - 1;
+	const size_t Home = (size_t)HashKey(Key) & Mask;
+	for(int i = 0; i < PROBE_LENGTH; ++i)
+	{
+		// Slots are never emptied again, so a sample is always before the first empty slot
+		SSlot &Slot = m_vSlots[(Home + i) & Mask];
+		if(Slot.m_LastUse == 0)
+			return nullptr;
+		if(Slot.Matches(Key))
+			return &Slot;
+	}
+	return nullptr;
+}
+
+CSampleCache::SSlot *CSampleCache::InsertSlot(const SKey &Key)
+{
+	const size_t Mask = m_vSlots.size() - 1;
+	const size_t Home = (size_t)HashKey(Key) & Mask;
+	SSlot *pOldest = nullptr;
+	for(int i = 0; i < PROBE_LENGTH; ++i)
+	{
+		SSlot &Slot = m_vSlots[(Home + i) & Mask];
+		if(Slot.m_LastUse == 0 || Slot.Matches(Key))
+			return &Slot;
+		if(!pOldest || Slot.m_LastUse < pOldest->m_LastUse)
+			pOldest = &Slot;
+	}
+	return pOldest;
+}
+
+uint32_t CSampleCache::NextUse()
+{
+	// On overflow the order of the samples is forgotten, which only costs some eviction accuracy
+	if(m_UseCounter == UINT32_MAX)
+	{
+		for(SSlot &Slot : m_vSlots)
+			Slot.m_LastUse = std::min(Slot.m_LastUse, 1u);
+		m_UseCounter = 1;
+	}
+	return ++m_UseCounter;
+}
+
+void CSampleCache::SampleDensityGrid(const Vec3 &StartCorner, const int64_t aStart[3], int Level, double StepSize, int Res, double PlanetRadius, float *pDensities, double Footprint)
+{
+	const int Count = Res * Res * Res;
+	const uint32_t Octaves = m_pGenerator->GetOctaveSignature(PlanetRadius, Footprint);
+
+	// In batches on the stack, the grid is sampled for every chunk
+	const int BatchSize = 256;
+	SKey aKeys[BatchSize];
+	int aMisses[BatchSize];
+	Vec3 aPositions[BatchSize];
+	float aDensities[BatchSize];
+
+	for(int First = 0; First < Count; First += BatchSize)
+	{
+		const int Num = std::min(BatchSize, Count - First);
+		for(int n = 0; n < Num; ++n)
+		{
+			const int Idx = First + n;
+			SKey &Key = aKeys[n];
+			Key.m_aIndex[0] = aStart[0] + Idx % Res;
+			Key.m_aIndex[1] = aStart[1] + (Idx / Res) % Res;
+			Key.m_aIndex[2] = aStart[2] + Idx / (Res * Res);
+			Key.m_Level = Level;
+			while(Key.m_Level > 0 && ((Key.m_aIndex[0] | Key.m_aIndex[1] | Key.m_aIndex[2]) & 1) == 0)
+			{
+				Key.m_aIndex[0] /= 2;
+				Key.m_aIndex[1] /= 2;
+				Key.m_aIndex[2] /= 2;
+				--Key.m_Level;
+			}
+		}
+
+		// One pass under the lock for the lookups, the misses are sampled outside of it
+		int NumMisses = 0;
+		{
+			std::lock_guard<std::mutex> Lock(m_Mutex);
+			if(m_vSlots.empty())
+				m_vSlots.resize(m_MaxSamples);
+			for(int n = 0; n < Num; ++n)
+			{
+				SSlot *pSlot = FindSlot(aKeys[n]);
+				if(pSlot && pSlot->m_Octaves == Octaves)
+				{
+					pSlot->m_LastUse = NextUse();
+					pDensities[First + n] = pSlot->m_Density;
+				}
+				else
+					aMisses[NumMisses++] = n;
+			}
+		}
+		m_Lookups += Num;
+		m_Hits += Num - NumMisses;
+
+		if(NumMisses == 0)
+			continue;
+
+		for(int i = 0; i < NumMisses; ++i)
+		{
+			const int Idx = First + aMisses[i];
+			const int x = Idx % Res, y = (Idx / Res) % Res, z = Idx / (Res * Res);
+			aPositions[i] = StartCorner + Vec3((double)x * StepSize, (double)y * StepSize, (double)z * StepSize);
+		}
+		m_pGenerator->GetDensities(aPositions, NumMisses, PlanetRadius, aDensities, nullptr, Footprint);
+
+		std::lock_guard<std::mutex> Lock(m_Mutex);
+		for(int i = 0; i < NumMisses; ++i)
+		{
+			pDensities[First + aMisses[i]] = aDensities[i];
+			SSlot *pSlot = InsertSlot(aKeys[aMisses[i]]);
+			std::copy(aKeys[aMisses[i]].m_aIndex, aKeys[aMisses[i]].m_aIndex + 3, pSlot->m_aIndex);
+			pSlot->m_Level = aKeys[aMisses[i]].m_Level;
+			pSlot->m_Octaves = Octaves;
+			pSlot->m_Density = aDensities[i];
+			pSlot->m_LastUse = NextUse();
+		}
+	}
+}
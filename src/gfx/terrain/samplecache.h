@@ -0,0 +1,73 @@
+#ifndef SAMPLECACHE_H
+#define SAMPLECACHE_H
+
+#include "../../sim/vmath.h"
+#include "terrain.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Densities of octree grid points, shared between siblings and between parents and children.
+// Every node samples a lattice of spacing RootStep / 2^Level anchored at the root corner, so a point is
+// identified by its lattice index and level. Indices are reduced to the coarsest level they exist on,
+// which makes a point that a parent sampled hit for its children as well.
+// The octaves a density was evaluated with are stored next to it rather than in the key, a lookup with
+// other octaves misses and replaces the sample.
+class CSampleCache
+{
+public:
+	size_t m_MaxSamples = 1 << 19; // a power of two
+
+	std::atomic<uint64_t> m_Lookups{0};
+	std::atomic<uint64_t> m_Hits{0};
+
+	void Init(CTerrainGenerator *pGenerator) { m_pGenerator = pGenerator; }
+	void Clear();
+	double GetHitRate() const;
+
+	// Same layout as CTerrainGenerator::SampleDensityGrid. aStart is the lattice index of the first point.
+	void SampleDensityGrid(const Vec3 &StartCorner, const int64_t aStart[3], int Level, double StepSize, int Res, double PlanetRadius, float *pDensities, double Footprint);
+
+private:
+	// Samples are found within this many slots of their hash, the least recently used one of them is replaced
+	enum
+	{
+		PROBE_LENGTH = 8,
+	};
+
+	struct SKey
+	{
+		int64_t m_aIndex[3];
+		int m_Level;
+	};
+
+	// 40 bytes, the key is stored flat to avoid padding
+	struct SSlot
+	{
+		int64_t m_aIndex[3];
+		int m_Level;
+		uint32_t m_Octaves; // see CTerrainGenerator::GetOctaveSignature
+		float m_Density;
+		uint32_t m_LastUse; // 0 for an empty slot
+
+		bool Matches(const SKey &Key) const
+		{
+			return m_aIndex[0] == Key.m_aIndex[0] && m_aIndex[1] == Key.m_aIndex[1] && m_aIndex[2] == Key.m_aIndex[2] && m_Level == Key.m_Level;
+		}
+	};
+
+	static uint64_t HashKey(const SKey &Key);
+	SSlot *FindSlot(const SKey &Key);
+	SSlot *InsertSlot(const SKey &Key);
+	uint32_t NextUse();
+
+	CTerrainGenerator *m_pGenerator = nullptr;
+
+	std::mutex m_Mutex;
+	// Open addressed with m_MaxSamples slots, allocated on first use
+	std::vector<SSlot> m_vSlots;
+	uint32_t m_UseCounter = 0;
+};
+
+#endif // SAMPLECACHE_H
@@ -1,6 +1,8 @@
 #include "terrain.h"
 #include <FastNoiseLite.h>
+#include <algorithm>
 #include <glm/gtc/noise.hpp>
+#include <vector>
 
 CTerrainGenerator::CTerrainGenerator() :
 	m_pContinentNoise(new FastNoiseLite()),
@@ -11,10 +13,19 @@ CTerrainGenerator::CTerrainGenerator() :
 	m_pMountainMaskNoise(new FastNoiseLite()),
 	m_pBiomeNoise(new FastNoiseLite())
 {
+	// Bodies that never call Init (stars) sample the default single octave noises
+	InitOctaveLods(m_ContinentLods, m_pContinentNoise, 1.0, 1);
+	InitOctaveLods(m_MountainLods, m_pMountainNoise, 1.0, 1);
+	InitOctaveLods(m_HillsLods, m_pHillsNoise, 1.0, 1);
+	InitOctaveLods(m_DetailLods, m_pDetailNoise, 1.0, 1);
 }
 
 CTerrainGenerator::~CTerrainGenerator()
 {
+	ClearOctaveLods(m_ContinentLods);
+	ClearOctaveLods(m_MountainLods);
+	ClearOctaveLods(m_HillsLods);
+	ClearOctaveLods(m_DetailLods);
 	delete m_pContinentNoise;
 	delete m_pMountainNoise;
 	delete m_pHillsNoise;
@@ -62,95 +73,309 @@ void CTerrainGenerator::Init(int Seed, const STerrainParameters &Params, ETerrai
 
 	m_pWarpNoise->SetSeed(Seed + 5);
 	m_pWarpNoise->SetFrequency(1.0f);
+
+	InitOctaveLods(m_ContinentLods, m_pContinentNoise, Params.m_ContinentFrequency, Params.m_ContinentOctaves);
+	InitOctaveLods(m_MountainLods, m_pMountainNoise, Params.m_MountainFrequency, Params.m_MountainOctaves);
+	InitOctaveLods(m_HillsLods, m_pHillsNoise, Params.m_HillsFrequency, Params.m_HillsOctaves);
+	// The detail layer is sampled at 4x the coordinates
+	InitOctaveLods(m_DetailLods, m_pDetailNoise, Params.m_DetailFrequency * 4.0, Params.m_DetailOctaves);
 }
 
-STerrainOutput CTerrainGenerator::GetTerrainOutput(Vec3 WorldPosmtion, double PlanetRadius)
+void CTerrainGenerator::InitOctaveLods(SOctaveLods &Lods, FastNoiseLite *pNoise, double Frequency, int Octaves)
 {
-	// STerrainOutput Output{};
-	// WorldPosmtion *= 1e-6;
-	// Output.density = m_pWarpNoise->GetNoise(WorldPosmtion.x, WorldPosmtion.y, WorldPosmtion.z);
-	// return Output;
+	ClearOctaveLods(Lods);
+	Lods.m_Frequency = Frequency;
+	Octaves = std::max(Octaves, 1);
 
-	double distance_from_center = WorldPosmtion.length();
-	float base_density = (float)(PlanetRadius - distance_from_center);
+	// FastNoiseLite divides a fractal by the sum of its octave amplitudes, which halve with the default gain
+	float FullSum = 0.0f, Amplitude = 1.0f;
+	for(int i = 0; i < Octaves; ++i)
+	{
+		FullSum += Amplitude;
+		Amplitude *= 0.5f;
+	}
 
-	Vec3 NormDouble = WorldPosmtion.normalize();
+	float Sum = 0.0f;
+	Amplitude = 1.0f;
+	for(int i = 1; i <= Octaves; ++i)
+	{
+		Sum += Amplitude;
+		Amplitude *= 0.5f;
+
+		FastNoiseLite *pCopy = pNoise;
+		if(i < Octaves)
+		{
+			pCopy = new FastNoiseLite(*pNoise);
+			pCopy->SetFractalOctaves(i);
+		}
+		Lods.m_vpNoises.push_back(pCopy);
+		Lods.m_vScales.push_back(i < Octaves ? Sum / FullSum : 1.0f);
+	}
+}
 
-	double nx = NormDouble.x;
-	double ny = NormDouble.y;
-	double nz = NormDouble.z;
+void CTerrainGenerator::ClearOctaveLods(SOctaveLods &Lods)
+{
+	// The last one is owned by the generator
+	for(size_t i = 0; i + 1 < Lods.m_vpNoises.size(); ++i)
+		delete Lods.m_vpNoises[i];
+	Lods.m_vpNoises.clear();
+	Lods.m_vScales.clear();
+}
 
-	float wx = m_pWarpNoise->GetNoise(nx, ny, nz);
-	float wy = m_pWarpNoise->GetNoise(ny, nz, nx);
-	float wz = m_pWarpNoise->GetNoise(nz, nx, ny);
+int CTerrainGenerator::GetOctaveLod(const SOctaveLods &Lods, double Footprint)
+{
+	const int Full = (int)Lods.m_vpNoises.size() - 1;
+	if(Footprint <= 0.0)
+		return Full;
+
+	// Octave i has frequency m_Frequency * 2^i and is kept while a period spans at least two samples
+	int Lod = 0;
+	double Frequency = Lods.m_Frequency * 2.0;
+	while(Lod < Full && Frequency * Footprint <= 0.5)
+	{
+		++Lod;
+		Frequency *= 2.0;
+	}
+	return Lod;
+}
 
-	// Apply warp to double coordinates
-	double w_nx = nx + (double)wx * 0.1;
-	double w_ny = ny + (double)wy * 0.1;
-	double w_nz = nz + (double)wz * 0.1;
+uint32_t CTerrainGenerator::GetOctaveSignature(double PlanetRadius, double Footprint) const
+{
+	const double NoiseFootprint = Footprint / PlanetRadius;
+	return (uint32_t)GetOctaveLod(m_ContinentLods, NoiseFootprint) |
+	       (uint32_t)GetOctaveLod(m_MountainLods, NoiseFootprint) << 8 |
+	       (uint32_t)GetOctaveLod(m_HillsLods, NoiseFootprint) << 16 |
+	       (uint32_t)GetOctaveLod(m_DetailLods, NoiseFootprint) << 24;
+}
 
-	float continent_val = m_pContinentNoise->GetNoise(w_nx, w_ny, w_nz);
+STerrainOutput CTerrainGenerator::GetTerrainOutput(Vec3 WorldPosition, double PlanetRadius, double Footprint)
+{
+	STerrainOutput Output;
+	GetTerrainOutputs(&WorldPosition, 1, PlanetRadius, &Output, Footprint);
+	return Output;
+}
 
-	float terrain_height = 0.0f;
-	bool isLand = continent_val > m_Params.m_SeaLevel;
+CTerrainGenerator::SLayerNoises CTerrainGenerator::GetLayerNoises(double PlanetRadius, double Footprint) const
+{
+	const double NoiseFootprint = Footprint / PlanetRadius;
+	const int ContinentLod = GetOctaveLod(m_ContinentLods, NoiseFootprint);
+	const int MountainLod = GetOctaveLod(m_MountainLods, NoiseFootprint);
+	const int HillsLod = GetOctaveLod(m_HillsLods, NoiseFootprint);
+	const int DetailLod = GetOctaveLod(m_DetailLods, NoiseFootprint);
+
+	SLayerNoises Noises;
+	Noises.m_pContinent = m_ContinentLods.m_vpNoises[ContinentLod];
+	Noises.m_pMountain = m_MountainLods.m_vpNoises[MountainLod];
+	Noises.m_pHills = m_HillsLods.m_vpNoises[HillsLod];
+	Noises.m_pDetail = m_DetailLods.m_vpNoises[DetailLod];
+	Noises.m_ContinentScale = m_ContinentLods.m_vScales[ContinentLod];
+	Noises.m_MountainScale = m_MountainLods.m_vScales[MountainLod];
+	Noises.m_HillsScale = m_HillsLods.m_vScales[HillsLod];
+	Noises.m_DetailScale = m_DetailLods.m_vScales[DetailLod];
+	return Noises;
+}
+
+void CTerrainGenerator::EvaluateHeights(const Vec3 *pPositions, int n, double PlanetRadius, const SLayerNoises &Noises, SBatch &Batch)
+{
+	// The noise calls stay scalar, FastNoiseLite has no vector path. Every layer runs as its own pass over the block,
+	// which shares the warped coordinates between the layers and picks the octaves once per call.
+	double aWarpedX[BATCH_SIZE], aWarpedY[BATCH_SIZE], aWarpedZ[BATCH_SIZE];
+	float aMountain[BATCH_SIZE], aNoise[BATCH_SIZE];
+	double *aNx = Batch.m_aNx, *aNy = Batch.m_aNy, *aNz = Batch.m_aNz;
+	float *aHeight = Batch.m_aHeight;
+
+	const float Radius = (float)PlanetRadius;
+	FastNoiseLite *pContinentNoise = Noises.m_pContinent;
+	FastNoiseLite *pMountainNoise = Noises.m_pMountain;
+	FastNoiseLite *pHillsNoise = Noises.m_pHills;
+	FastNoiseLite *pDetailNoise = Noises.m_pDetail;
+	const float ContinentScale = Noises.m_ContinentScale;
+	const float MountainScale = Noises.m_MountainScale;
+	const float HillsScale = Noises.m_HillsScale;
+	const float DetailScale = Noises.m_DetailScale;
+
+	for(int i = 0; i < n; ++i)
+	{
+		double Dist = pPositions[i].length();
+		Batch.m_aBaseDensity[i] = (float)(PlanetRadius - Dist);
+		aNx[i] = pPositions[i].x / Dist;
+		aNy[i] = pPositions[i].y / Dist;
+		aNz[i] = pPositions[i].z / Dist;
+	}
 
-	if(isLand)
-		terrain_height += (continent_val) * ((float)PlanetRadius * m_Params.m_ContinentHeight);
-	else
-		terrain_height += (continent_val) * ((float)PlanetRadius * m_Params.m_OceanDepth);
+	// Domain warp, shared by all layers below
+	for(int i = 0; i < n; ++i)
+		aWarpedX[i] = aNx[i] + (double)m_pWarpNoise->GetNoise(aNx[i], aNy[i], aNz[i]) * 0.1;
+	for(int i = 0; i < n; ++i)
+		aWarpedY[i] = aNy[i] + (double)m_pWarpNoise->GetNoise(aNy[i], aNz[i], aNx[i]) * 0.1;
+	for(int i = 0; i < n; ++i)
+		aWarpedZ[i] = aNz[i] + (double)m_pWarpNoise->GetNoise(aNz[i], aNx[i], aNy[i]) * 0.1;
 
-	float mountain_mask = m_pMountainMaskNoise->GetNoise(nx, ny, nz);
-	float m_val = 0.0f;
+	for(int i = 0; i < n; ++i)
+	{
+		float Continent = pContinentNoise->GetNoise(aWarpedX[i], aWarpedY[i], aWarpedZ[i]) * ContinentScale;
+		bool bIsLand = Continent > m_Params.m_SeaLevel;
+		aHeight[i] = Continent * (Radius * (bIsLand ? m_Params.m_ContinentHeight : m_Params.m_OceanDepth));
+	}
 
-	if(mountain_mask > 0.2f)
+	for(int i = 0; i < n; ++i)
 	{
-		float mask_strength = (mountain_mask - 0.2f) / 0.8f;
-		float m_raw = m_pMountainNoise->GetNoise(w_nx, w_ny, w_nz);
+		aMountain[i] = 0.0f;
+		float MountainMask = m_pMountainMaskNoise->GetNoise(aNx[i], aNy[i], aNz[i]);
+		if(MountainMask > 0.2f)
+		{
+			float MaskStrength = (MountainMask - 0.2f) / 0.8f;
+			float Ridge = 1.0f - std::abs(pMountainNoise->GetNoise(aWarpedX[i], aWarpedY[i], aWarpedZ[i]) * MountainScale);
+			aMountain[i] = pow(Ridge, 3.0f);
+			aHeight[i] += aMountain[i] * MaskStrength * (Radius * m_Params.m_MountainHeight);
+		}
+	}
 
-		m_val = 1.0f - std::abs(m_raw);
-		m_val = pow(m_val, 3.0f);
+	for(int i = 0; i < n; ++i)
+		aNoise[i] = pHillsNoise->GetNoise(aWarpedX[i], aWarpedY[i], aWarpedZ[i]) * HillsScale;
+	for(int i = 0; i < n; ++i)
+		aHeight[i] += aNoise[i] * (1.0f - glm::clamp(aMountain[i], 0.0f, 1.0f)) * (Radius * m_Params.m_HillsHeight);
 
-		terrain_height += m_val * mask_strength * ((float)PlanetRadius * m_Params.m_MountainHeight);
+	for(int i = 0; i < n; ++i)
+		aNoise[i] = pDetailNoise->GetNoise(aWarpedX[i] * 4.0, aWarpedY[i] * 4.0, aWarpedZ[i] * 4.0) * DetailScale;
+	for(int i = 0; i < n; ++i)
+		aHeight[i] += aNoise[i] * (1.0f - glm::clamp(aMountain[i], 0.0f, 1.0f)) * (Radius * m_Params.m_DetailHeight);
+
+	for(int i = 0; i < n; ++i)
+	{
+		Batch.m_aIceInfluence[i] = GetIceInfluence(aNy[i]);
+		aHeight[i] += Batch.m_aIceInfluence[i] * (Radius * 0.002f);
 	}
+}
 
-	float hill_mask = 1.0f - glm::clamp(m_val, 0.0f, 1.0f);
-	float hills = m_pHillsNoise->GetNoise(w_nx, w_ny, w_nz);
-	terrain_height += hills * hill_mask * ((float)PlanetRadius * m_Params.m_HillsHeight);
+float CTerrainGenerator::GetIceInfluence(double Ny) const
+{
+	float Latitude = std::abs((float)Ny);
+	if(Latitude <= m_Params.m_PolarIceCapLatitude)
+		return 0.0f;
+	float t = (Latitude - m_Params.m_PolarIceCapLatitude) / (1.0f - m_Params.m_PolarIceCapLatitude);
+	return t * t;
+}
 
-	float detail = m_pDetailNoise->GetNoise(w_nx * 4.0, w_ny * 4.0, w_nz * 4.0);
-	terrain_height += detail * hill_mask * ((float)PlanetRadius * m_Params.m_DetailHeight);
+void CTerrainGenerator::EvaluateBiomes(int n, double PlanetRadius, const SBatch &Batch, STerrainOutput *pOutputs)
+{
+	const double *aNx = Batch.m_aNx, *aNy = Batch.m_aNy, *aNz = Batch.m_aNz;
+	const float *aHeight = Batch.m_aHeight;
+	const float Radius = (float)PlanetRadius;
 
-	float latitude = std::abs((float)ny); // Latitude calculation is fine in float
-	float ice_influence = 0.0f;
-	if(latitude > m_Params.m_PolarIceCapLatitude)
+	for(int i = 0; i < n; ++i)
 	{
-		float t = (latitude - m_Params.m_PolarIceCapLatitude) / (1.0f - m_Params.m_PolarIceCapLatitude);
-		t = t * t;
-		ice_influence = t;
-		terrain_height += t * ((float)PlanetRadius * 0.002f);
+		float TempNoise = m_pBiomeNoise->GetNoise(aNx[i] + 50.0, aNy[i], aNz[i]);
+		float HeightCooling = (aHeight[i] / Radius) * 100.0f;
+		float Temperature = (1.0f - std::abs((float)aNy[i])) + (TempNoise * 0.2f) - HeightCooling + m_Params.m_TemperatureOffset;
+		pOutputs[i].temperature = glm::clamp(Temperature, 0.0f, 1.0f);
 	}
 
-	float temp_noise = m_pBiomeNoise->GetNoise(nx + 50.0, ny, nz);
-	float base_temp = 1.0f - latitude;
-	float height_cooling = (terrain_height / (float)PlanetRadius) * 100.0f;
+	for(int i = 0; i < n; ++i)
+	{
+		float MoistureNoise = m_pBiomeNoise->GetNoise(aNx[i], aNy[i] + 50.0, aNz[i]);
+		float Moisture = (MoistureNoise * 0.5f + 0.5f) + m_Params.m_MoistureOffset;
+		if(aHeight[i] < 0.0f)
+			Moisture += 0.2f;
+		pOutputs[i].moisture = glm::clamp(Moisture, 0.0f, 1.0f);
+	}
+}
+
+void CTerrainGenerator::GetDensities(const Vec3 *pPositions, int Count, double PlanetRadius, float *pDensities, float *pElevations, double Footprint)
+{
+	const SLayerNoises Noises = GetLayerNoises(PlanetRadius, Footprint);
+	SBatch Batch;
+	for(int Base = 0; Base < Count; Base += BATCH_SIZE)
+	{
+		const int n = std::min(BATCH_SIZE, Count - Base);
+		EvaluateHeights(pPositions + Base, n, PlanetRadius, Noises, Batch);
+
+		for(int i = 0; i < n; ++i)
+			pDensities[Base + i] = Batch.m_aBaseDensity[i] + Batch.m_aHeight[i];
+		if(pElevations)
+		{
+			for(int i = 0; i < n; ++i)
+				pElevations[Base + i] = Batch.m_aHeight[i];
+		}
+	}
+}
+
+void CTerrainGenerator::GetTerrainOutputs(const Vec3 *pPositions, int Count, double PlanetRadius, STerrainOutput *pOutputs, double Footprint)
+{
+	SBatch Batch;
+	const float *aHeight = Batch.m_aHeight;
+	const SLayerNoises Noises = GetLayerNoises(PlanetRadius, Footprint);
 
-	float final_temp = base_temp + (temp_noise * 0.2f) - height_cooling + m_Params.m_TemperatureOffset;
-	final_temp = glm::clamp(final_temp, 0.0f, 1.0f);
+	for(int Base = 0; Base < Count; Base += BATCH_SIZE)
+	{
+		const int n = std::min(BATCH_SIZE, Count - Base);
+		STerrainOutput *pOut = pOutputs + Base;
+		EvaluateHeights(pPositions + Base, n, PlanetRadius, Noises, Batch);
+
+		for(int i = 0; i < n; ++i)
+		{
+			pOut[i].density = Batch.m_aBaseDensity[i] + aHeight[i];
+			pOut[i].elevation = aHeight[i];
+			pOut[i].material_mask = Batch.m_aIceInfluence[i];
+		}
+		EvaluateBiomes(n, PlanetRadius, Batch, pOut);
+	}
+}
 
-	float moisture_noise = m_pBiomeNoise->GetNoise(nx, ny + 50.0, nz);
-	float final_moisture = (moisture_noise * 0.5f + 0.5f) + m_Params.m_MoistureOffset;
-	if(terrain_height < 0.0f)
-		final_moisture += 0.2f;
-	final_moisture = glm::clamp(final_moisture, 0.0f, 1.0f);
+void CTerrainGenerator::GetBiomes(const Vec3 *pPositions, const float *pElevations, int Count, double PlanetRadius, STerrainOutput *pOutputs)
+{
+	SBatch Batch;
+	for(int Base = 0; Base < Count; Base += BATCH_SIZE)
+	{
+		const int n = std::min(BATCH_SIZE, Count - Base);
+		STerrainOutput *pOut = pOutputs + Base;
+		for(int i = 0; i < n; ++i)
+		{
+			const Vec3 &Position = pPositions[Base + i];
+			double Dist = Position.length();
+			Batch.m_aNx[i] = Position.x / Dist;
+			Batch.m_aNy[i] = Position.y / Dist;
+			Batch.m_aNz[i] = Position.z / Dist;
+			Batch.m_aHeight[i] = pElevations[Base + i];
+
+			pOut[i].density = (float)(PlanetRadius - Dist) + pElevations[Base + i];
+			pOut[i].elevation = pElevations[Base + i];
+			pOut[i].material_mask = GetIceInfluence(Batch.m_aNy[i]);
+		}
+		EvaluateBiomes(n, PlanetRadius, Batch, pOut);
+	}
+}
 
-	float material_mask = ice_influence;
+void CTerrainGenerator::SampleGrid(const Vec3 &StartCorner, double StepSize, int Res, double PlanetRadius, STerrainOutput *pOutputs, double Footprint)
+{
+	std::vector<Vec3> vRow(Res);
+	for(int z = 0; z < Res; ++z)
+	{
+		for(int y = 0; y < Res; ++y)
+		{
+			for(int x = 0; x < Res; ++x)
+				vRow[x] = StartCorner + Vec3((double)x * StepSize, (double)y * StepSize, (double)z * StepSize);
+			GetTerrainOutputs(vRow.data(), Res, PlanetRadius, pOutputs + (y + z * Res) * Res, Footprint);
+		}
+	}
+}
 
-	return {
-		base_density + terrain_height,
-		terrain_height,
-		final_temp,
-		final_moisture,
-		material_mask};
+void CTerrainGenerator::SampleDensityGrid(const Vec3 &StartCorner, double StepSize, int Res, double PlanetRadius, float *pDensities, double Footprint)
+{
+	const int BatchSize = 256;
+	Vec3 aPositions[BatchSize];
+	const int Count = Res * Res * Res;
+	for(int First = 0; First < Count; First += BatchSize)
+	{
+		const int Num = std::min(BatchSize, Count - First);
+		for(int n = 0; n < Num; ++n)
+		{
+			const int Idx = First + n;
+			const int x = Idx % Res, y = (Idx / Res) % Res, z = Idx / (Res * Res);
+			aPositions[n] = StartCorner + Vec3((double)x * StepSize, (double)y * StepSize, (double)z * StepSize);
+		}
+		GetDensities(aPositions, Num, PlanetRadius, pDensities + First, nullptr, Footprint);
+	}
 }
 
 glm::vec3 CTerrainGenerator::CalculateDensityGradient(Vec3 p, double PlanetRadius)
@@ -159,9 +384,64 @@ glm::vec3 CTerrainGenerator::CalculateDensityGradient(Vec3 p, double PlanetRadiu
 	if(eps < 1e-4)
 		eps = 1e-4;
 
-	float dx = GetTerrainOutput(p + Vec3(eps, 0, 0), PlanetRadius).density - GetTerrainOutput(p - Vec3(eps, 0, 0), PlanetRadius).density;
-	float dy = GetTerrainOutput(p + Vec3(0, eps, 0), PlanetRadius).density - GetTerrainOutput(p - Vec3(0, eps, 0), PlanetRadius).density;
-	float dz = GetTerrainOutput(p + Vec3(0, 0, eps), PlanetRadius).density - GetTerrainOutput(p - Vec3(0, 0, eps), PlanetRadius).density;
+	const Vec3 aPositions[6] = {p + Vec3(eps, 0, 0), p - Vec3(eps, 0, 0), p + Vec3(0, eps, 0), p - Vec3(0, eps, 0), p + Vec3(0, 0, eps), p - Vec3(0, 0, eps)};
+	float aDensities[6];
+	GetDensities(aPositions, 6, PlanetRadius, aDensities);
+
+	float dx = aDensities[0] - aDensities[1];
+	float dy = aDensities[2] - aDensities[3];
+	float dz = aDensities[4] - aDensities[5];
 
 	return -glm::normalize(glm::vec3(dx, dy, dz));
 }
+
+void CTerrainGenerator::GetElevationRange(double PlanetRadius, double &MinElevation, double &MaxElevation) const
+{
+	// Every noise is within [-1, 1] and every mask within [0, 1], see EvaluateHeights. Above a positive sea level the
+	// continent noise still uses the ocean scale.
+	const STerrainParameters &P = m_Params;
+	MaxElevation = PlanetRadius * (std::max(P.m_ContinentHeight, P.m_OceanDepth) + P.m_MountainHeight + P.m_HillsHeight + P.m_DetailHeight + 0.002);
+	MinElevation = -PlanetRadius * (std::max(P.m_ContinentHeight, P.m_OceanDepth) + P.m_HillsHeight + P.m_DetailHeight);
+}
+
+double CTerrainGenerator::GetElevationSlopeBound(double PlanetRadius) const
+{
+	// Gradient of a single noise octave relative to its frequency. An estimate for OpenSimplex2, not a proven bound.
+	const double NoiseSlope = 4.0;
+	const STerrainParameters &P = m_Params;
+	auto Layer = [&](double Frequency, int Octaves) { return NoiseSlope * Frequency * std::max(Octaves, 1); };
+
+	const double Warp = 1.0 + 0.1 * Layer(1.0, 1);
+	const double Continent = Layer(P.m_ContinentFrequency, P.m_ContinentOctaves) * Warp;
+	const double Ridge = 3.0 * Layer(P.m_MountainFrequency, P.m_MountainOctaves) * Warp;
+	const double Mask = Layer(P.m_MountainMaskFrequency, 1) / 0.8;
+	const double Hills = Layer(P.m_HillsFrequency, P.m_HillsOctaves) * Warp;
+	const double Detail = 4.0 * Layer(P.m_DetailFrequency, P.m_DetailOctaves) * Warp;
+	const double Ice = 2.0 / std::max(1.0 - (double)P.m_PolarIceCapLatitude, 1e-3);
+
+	return PlanetRadius * (std::max(P.m_ContinentHeight, P.m_OceanDepth) * Continent +
+				      P.m_MountainHeight * (Ridge + Mask) +
+				      P.m_HillsHeight * (Hills + Ridge) +
+				      P.m_DetailHeight * (Detail + Ridge) +
+				      0.002 * Ice);
+}
+
+double CTerrainGenerator::GetFootprintErrorBound(double PlanetRadius, double Footprint) const
+{
+	// The skipped octaves of a noise add up to at most the share of the amplitude its scale leaves out, see InitOctaveLods
+	const double NoiseFootprint = Footprint / PlanetRadius;
+	auto Skipped = [&](const SOctaveLods &Lods) { return 1.0 - (double)Lods.m_vScales[GetOctaveLod(Lods, NoiseFootprint)]; };
+	const STerrainParameters &P = m_Params;
+
+	const double Continent = Skipped(m_ContinentLods);
+	// A continent value at the sea level can end up on the other side and switch between the land and the ocean scale
+	const double Coast = Continent > 0.0 ? (std::abs((double)P.m_SeaLevel) + Continent) * std::abs((double)P.m_ContinentHeight - P.m_OceanDepth) : 0.0;
+	const double Ridge = 3.0 * Skipped(m_MountainLods);
+	const double Hills = Skipped(m_HillsLods);
+	const double Detail = Skipped(m_DetailLods);
+
+	return PlanetRadius * (std::max(P.m_ContinentHeight, P.m_OceanDepth) * Continent + Coast +
+				      P.m_MountainHeight * Ridge +
+				      P.m_HillsHeight * (Hills + Ridge) +
+				      P.m_DetailHeight * (Detail + Ridge));
+}
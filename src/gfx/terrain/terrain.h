@@ -3,7 +3,9 @@
 
 #include "../../sim/body.h"
 #include "../../sim/vmath.h" // Include Vec3
+#include <cstdint>
 #include <glm/glm.hpp>
+#include <vector>
 
 class FastNoiseLite;
 
@@ -24,11 +26,73 @@ public:
 
 	void Init(int Seed, const STerrainParameters &Params, ETerrainType TerrainType);
 
-	STerrainOutput GetTerrainOutput(Vec3 WorldPosition, double PlanetRadius);
+	// Points are evaluated in blocks, one noise layer at a time over the block. Only the loops are batched, every noise
+	// value is still a scalar FastNoiseLite call.
+	static const int BATCH_SIZE = 64;
+
+	// Footprint is the sample spacing at the surface. Fractal octaves finer than two samples per period are
+	// skipped, 0 evaluates all of them.
+	STerrainOutput GetTerrainOutput(Vec3 WorldPosition, double PlanetRadius, double Footprint = 0.0);
+	// Same as GetTerrainOutput for Count points, the octaves are picked once for all of them
+	void GetTerrainOutputs(const Vec3 *pPositions, int Count, double PlanetRadius, STerrainOutput *pOutputs, double Footprint = 0.0);
+	// Res^3 points starting at StartCorner, x varies fastest
+	void SampleGrid(const Vec3 &StartCorner, double StepSize, int Res, double PlanetRadius, STerrainOutput *pOutputs, double Footprint = 0.0);
+
+	// Only the density (and optionally the elevation), skips the biome noise
+	void GetDensities(const Vec3 *pPositions, int Count, double PlanetRadius, float *pDensities, float *pElevations = nullptr, double Footprint = 0.0);
+	void SampleDensityGrid(const Vec3 &StartCorner, double StepSize, int Res, double PlanetRadius, float *pDensities, double Footprint = 0.0);
+	// Outputs of surface points whose elevation is already known, only the temperature and moisture noise is evaluated
+	void GetBiomes(const Vec3 *pPositions, const float *pElevations, int Count, double PlanetRadius, STerrainOutput *pOutputs);
+
+	// Identifies the octaves evaluated at a footprint, equal signatures give equal densities
+	uint32_t GetOctaveSignature(double PlanetRadius, double Footprint) const;
 
 	glm::vec3 CalculateDensityGradient(Vec3 p, double PlanetRadius);
 
+	// Range of elevation the surface can reach around PlanetRadius
+	void GetElevationRange(double PlanetRadius, double &MinElevation, double &MaxElevation) const;
+	// Estimate of the largest elevation gradient with respect to the direction from the center, per radian. Not a proven
+	// bound, terrain steeper than it can be missed by CProceduralMesh::CanContainSurface.
+	double GetElevationSlopeBound(double PlanetRadius) const;
+	// Upper bound of how far the elevation moves when the octaves skipped at Footprint are added back
+	double GetFootprintErrorBound(double PlanetRadius, double Footprint) const;
+
 private:
+	// Intermediate values of up to BATCH_SIZE points
+	struct SBatch
+	{
+		double m_aNx[BATCH_SIZE], m_aNy[BATCH_SIZE], m_aNz[BATCH_SIZE]; // direction from the center
+		float m_aBaseDensity[BATCH_SIZE];
+		float m_aHeight[BATCH_SIZE];
+		float m_aIceInfluence[BATCH_SIZE];
+	};
+
+	// A fractal noise and copies of it with fewer octaves, index i has i + 1 octaves and the last one is the noise itself
+	struct SOctaveLods
+	{
+		std::vector<FastNoiseLite *> m_vpNoises;
+		std::vector<float> m_vScales; // keeps the remaining octaves at the amplitude they have in the full noise
+		double m_Frequency = 1.0; // of the first octave, on the unit sphere
+	};
+
+	void InitOctaveLods(SOctaveLods &Lods, FastNoiseLite *pNoise, double Frequency, int Octaves);
+	void ClearOctaveLods(SOctaveLods &Lods);
+	// Index into Lods for a footprint on the unit sphere
+	static int GetOctaveLod(const SOctaveLods &Lods, double Footprint);
+
+	// Noise of every fractal layer at a footprint with the scale that goes with it
+	struct SLayerNoises
+	{
+		FastNoiseLite *m_pContinent, *m_pMountain, *m_pHills, *m_pDetail;
+		float m_ContinentScale, m_MountainScale, m_HillsScale, m_DetailScale;
+	};
+
+	SLayerNoises GetLayerNoises(double PlanetRadius, double Footprint) const;
+	void EvaluateHeights(const Vec3 *pPositions, int n, double PlanetRadius, const SLayerNoises &Noises, SBatch &Batch);
+	// Temperature and moisture from the directions and heights in Batch
+	void EvaluateBiomes(int n, double PlanetRadius, const SBatch &Batch, STerrainOutput *pOutputs);
+	float GetIceInfluence(double Ny) const;
+
 	FastNoiseLite *m_pContinentNoise;
 	FastNoiseLite *m_pMountainNoise;
 	FastNoiseLite *m_pHillsNoise;
@@ -38,6 +102,11 @@ private:
 	FastNoiseLite *m_pMountainMaskNoise;
 	FastNoiseLite *m_pBiomeNoise;
 
+	SOctaveLods m_ContinentLods;
+	SOctaveLods m_MountainLods;
+	SOctaveLods m_HillsLods;
+	SOctaveLods m_DetailLods;
+
 	ETerrainType m_TerrainType;
 	STerrainParameters m_Params;
 };
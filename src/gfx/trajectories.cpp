@@ -5,195 +5,550 @@
 #include <cstdio>
 #include <embedded_shaders.h>
 
+static double AngleBetween(const Vec3 &a, const Vec3 &b)
+{
+	return std::atan2(a.cross(b).length(), a.dot(b));
+}
+
+static uint32_t PackColor(const glm::vec3 &Color)
+{
+	auto Channel = [](float c) { return (uint32_t)(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f); };
+	return Channel(Color.x) | (Channel(Color.y) << 8) | (Channel(Color.z) << 16) | (255u << 24);
+}
+
+// Blocks until the draw with the given serial stopped reading the mapped buffers. The fence of an older draw
+// only gets replaced after it was waited for, so a serial whose fence is gone is done already.
+void CTrajectories::WaitForDraw(uint64_t Serial)
+{
+	GLsync &Fence = m_aDrawFences[Serial % FRAMES];
+	if(!Fence || m_aFenceSerials[Serial % FRAMES] != Serial)
+		return;
+	while(glClientWaitSync(Fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+		;
+	glDeleteSync(Fence);
+	Fence = nullptr;
+}
+
+static void SplitDouble(double Value, float &High, float &Low)
+{
+	High = (float)Value;
+	Low = (float)(Value - (double)High);
+}
+
+// Lays out all regions again in new buffers, doubling the ones that are full
+void CTrajectories::Reallocate()
+{
+	// Keeps a whole free block behind the predicted position, so starting a new block never re-anchors live samples
+	auto NewCapacity = [](const STrajectory &Traj) {
+		return Traj.m_Count + 2 + BLOCK_SIZE > Traj.Capacity() ? std::max<size_t>(64, Traj.Capacity() * 2) : Traj.Capacity();
+	};
+
+	std::vector<size_t> vNewBase(m_vPlanetTrajectories.size());
+	size_t Slots = 0;
+	for(size_t i = 0; i < m_vPlanetTrajectories.size(); ++i)
+	{
+		vNewBase[i] = Slots;
+		Slots += NewCapacity(m_vPlanetTrajectories[i]) + BLOCK_SIZE;
+	}
+
+	const GLbitfield Flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLuint NewSampleBuffer, NewAnchorBuffer;
+	glGenBuffers(1, &NewSampleBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, NewSampleBuffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, Slots * sizeof(SGPUSample), nullptr, Flags);
+	glGenBuffers(1, &NewAnchorBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, NewAnchorBuffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, Slots / BLOCK_SIZE * sizeof(SGPUAnchor), nullptr, Flags);
+
+	// Rotates a region by whole blocks so the block holding the oldest sample ends up first, then fills the mirror
+	auto CopyRegion = [](size_t Stride, size_t OldBase, size_t OldSize, size_t Rotate, size_t NewBase, size_t NewMirror) {
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (OldBase + Rotate) * Stride, NewBase * Stride, (OldSize - Rotate) * Stride);
+		if(Rotate > 0)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, OldBase * Stride, (NewBase + OldSize - Rotate) * Stride, Rotate * Stride);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (OldBase + Rotate) * Stride, NewMirror * Stride, Stride);
+	};
+
+	if(m_SampleBuffer)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, m_SampleBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, NewSampleBuffer);
+		for(size_t i = 0; i < m_vPlanetTrajectories.size(); ++i)
+		{
+			const auto &Traj = m_vPlanetTrajectories[i];
+			if(Traj.Capacity() > 0)
+				CopyRegion(sizeof(SGPUSample), Traj.m_BaseSlot, Traj.Capacity(), Traj.m_Tail / BLOCK_SIZE * BLOCK_SIZE, vNewBase[i], vNewBase[i] + NewCapacity(Traj));
+		}
+
+		glBindBuffer(GL_COPY_READ_BUFFER, m_AnchorBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, NewAnchorBuffer);
+		for(size_t i = 0; i < m_vPlanetTrajectories.size(); ++i)
+		{
+			const auto &Traj = m_vPlanetTrajectories[i];
+			if(Traj.Capacity() > 0)
+				CopyRegion(sizeof(SGPUAnchor), Traj.m_BaseSlot / BLOCK_SIZE, Traj.Capacity() / BLOCK_SIZE, Traj.m_Tail / BLOCK_SIZE, vNewBase[i] / BLOCK_SIZE, (vNewBase[i] + NewCapacity(Traj)) / BLOCK_SIZE);
+		}
+
+		// Deleting them unmaps them as well
+		glDeleteBuffers(1, &m_SampleBuffer);
+		glDeleteBuffers(1, &m_AnchorBuffer);
+	}
+
+	for(size_t i = 0; i < m_vPlanetTrajectories.size(); ++i)
+	{
+		auto &Traj = m_vPlanetTrajectories[i];
+		const size_t Capacity = NewCapacity(Traj);
+		const size_t Rotate = Traj.m_Tail / BLOCK_SIZE;
+
+		std::vector<uint64_t> vTicks(Capacity);
+		std::vector<Vec3> vAnchors(Capacity / BLOCK_SIZE);
+		// The new buffers were never drawn from
+		Traj.m_vBlockSerials.assign(Capacity / BLOCK_SIZE, 0);
+		for(size_t j = 0; j < Traj.Capacity(); ++j)
+			vTicks[j] = Traj.m_vTicks[(j + Rotate * BLOCK_SIZE) % Traj.Capacity()];
+		for(size_t j = 0; j < Traj.m_vAnchors.size(); ++j)
+			vAnchors[j] = Traj.m_vAnchors[(j + Rotate) % Traj.m_vAnchors.size()];
+
+		Traj.m_vTicks.swap(vTicks);
+		Traj.m_vAnchors.swap(vAnchors);
+		Traj.m_Tail %= BLOCK_SIZE;
+		Traj.m_BaseSlot = vNewBase[i];
+	}
+
+	m_SampleBuffer = NewSampleBuffer;
+	m_AnchorBuffer = NewAnchorBuffer;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_SampleBuffer);
+	m_pSamples = (SGPUSample *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, Slots * sizeof(SGPUSample), Flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_AnchorBuffer);
+	m_pAnchors = (SGPUAnchor *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, Slots / BLOCK_SIZE * sizeof(SGPUAnchor), Flags);
+	// The copies have to land before anything gets written through the new mappings
+	glFinish();
+}
+
+void CTrajectories::WriteAnchor(STrajectory &Traj, size_t Block, const Vec3 &Pos)
+{
+	SGPUAnchor Anchor;
+	SplitDouble(Pos.x, Anchor.m_aHigh[0], Anchor.m_aLow[0]);
+	SplitDouble(Pos.y, Anchor.m_aHigh[1], Anchor.m_aLow[1]);
+	SplitDouble(Pos.z, Anchor.m_aHigh[2], Anchor.m_aLow[2]);
+	Anchor.m_Color = Traj.m_PackedColor;
+	Anchor.m_Padding = 0.0f;
+
+	Traj.m_vAnchors[Block] = Pos;
+	m_pAnchors[Traj.m_BaseSlot / BLOCK_SIZE + Block] = Anchor;
+	if(Block == 0)
+		m_pAnchors[(Traj.m_BaseSlot + Traj.Capacity()) / BLOCK_SIZE] = Anchor;
+}
+
+void CTrajectories::WriteSample(STrajectory &Traj, size_t i, uint64_t Tick, const Vec3 &Pos)
+{
+	const size_t Slot = Traj.Slot(i);
+	const size_t Block = Slot / BLOCK_SIZE;
+	// Slots are only written again after they were dropped, wait for the last draw that could still read them
+	WaitForDraw(Traj.m_vBlockSerials[Block]);
+
+	// The rest of the block is free when writing behind the last sample, so it can be anchored here
+	if(Slot % BLOCK_SIZE == 0 && i >= Traj.m_Count)
+		WriteAnchor(Traj, Block, Pos);
+
+	const Vec3 Offset = Pos - Traj.m_vAnchors[Block];
+	SGPUSample Sample;
+	Sample.m_aOffset[0] = (float)Offset.x;
+	Sample.m_aOffset[1] = (float)Offset.y;
+	Sample.m_aOffset[2] = (float)Offset.z;
+	Sample.m_Tick = (uint32_t)Tick;
+
+	Traj.m_vTicks[Slot] = Tick;
+	m_pSamples[Traj.m_BaseSlot + Slot] = Sample;
+	if(Slot == 0)
+		m_pSamples[Traj.m_BaseSlot + Traj.Capacity()] = Sample;
+}
+
+void CTrajectories::WriteEnd(size_t End, uint64_t Tick, const Vec3 &Pos, uint32_t Link, uint32_t Color)
+{
+	SGPUEnd &Dest = m_pEnds[m_EndRegion + End];
+	SplitDouble(Pos.x, Dest.m_aHigh[0], Dest.m_aLow[0]);
+	SplitDouble(Pos.y, Dest.m_aHigh[1], Dest.m_aLow[1]);
+	SplitDouble(Pos.z, Dest.m_aHigh[2], Dest.m_aLow[2]);
+	Dest.m_Tick = (uint32_t)Tick;
+	Dest.m_Link = Link;
+	Dest.m_Color = Color;
+	Dest.m_aPadding[0] = Dest.m_aPadding[1] = Dest.m_aPadding[2] = 0;
+}
+
+void CTrajectories::PushBack(int Index, uint64_t Tick, const Vec3 &Pos)
+{
+	auto &Traj = m_vPlanetTrajectories[Index];
+	// Keep the slot behind the last sample free for the predicted position, plus a block of slack
+	if(Traj.m_Count + 2 + BLOCK_SIZE > Traj.Capacity())
+		Reallocate();
+	WriteSample(Traj, Traj.m_Count, Tick, Pos);
+	++Traj.m_Count;
+}
+
+// The sampled paths are drawn relative to the reference body, so the ellipse is the orbit around it as well. Bodies
+// that do not follow a two-body orbit around the reference body fail the perturbation test and keep their path.
+bool CTrajectories::GetOrbit(const CStarSystem &System, int Index, const Vec3 &CameraPos, SGPUOrbit &Orbit) const
+{
+	if(m_RefIndex == -1 || m_RefIndex == Index)
+		return false;
+
+	const auto &Body = System.m_vBodies[Index].m_SimParams;
+	const auto &Parent = System.m_vBodies[m_RefIndex].m_SimParams;
+	const double Mu = G * (Body.m_Mass + Parent.m_Mass);
+	const Vec3 r = Body.m_Position - Parent.m_Position;
+	const Vec3 v = Body.m_Velocity - Parent.m_Velocity;
+	const double Dist = r.length();
+
+	// How far off the two-body problem the body currently is
+	const Vec3 TwoBodyAcc = r * (-Mu / (Dist * Dist * Dist));
+	const Vec3 Perturbation = (Body.m_Acceleration - Parent.m_Acceleration) - TwoBodyAcc;
+	if(Perturbation.length() > m_MaxOrbitPerturbation * TwoBodyAcc.length())
+		return false;
+
+	const double Energy = v.dot(v) * 0.5 - Mu / Dist;
+	if(Energy >= 0.0)
+		return false; // unbound
+
+	const Vec3 h = r.cross(v);
+	const Vec3 EccVec = v.cross(h) / Mu - r / Dist;
+	const double a = -Mu / (2.0 * Energy);
+	const double e = EccVec.length();
+	if(e >= 1.0 || h.length() == 0.0)
+		return false;
+
+	const Vec3 P = e > 1e-9 ? EccVec / e : r / Dist;
+	const Vec3 Q = h.cross(P).normalize();
+	const double b = a * std::sqrt(1.0 - e * e);
+
+	const Vec3 BodyOffset = Body.m_Position - CameraPos;
+	Orbit.m_aBodyOffset[0] = (float)BodyOffset.x;
+	Orbit.m_aBodyOffset[1] = (float)BodyOffset.y;
+	Orbit.m_aBodyOffset[2] = (float)BodyOffset.z;
+	Orbit.m_SemiMajorAxis = (float)a;
+	Orbit.m_aPeriapsisDir[0] = (float)P.x;
+	Orbit.m_aPeriapsisDir[1] = (float)P.y;
+	Orbit.m_aPeriapsisDir[2] = (float)P.z;
+	Orbit.m_Eccentricity = (float)e;
+	Orbit.m_aNormalDir[0] = (float)Q.x;
+	Orbit.m_aNormalDir[1] = (float)Q.y;
+	Orbit.m_aNormalDir[2] = (float)Q.z;
+	Orbit.m_Color = m_vPlanetTrajectories[Index].m_PackedColor;
+	Orbit.m_EccentricAnomaly = (float)std::atan2(r.dot(Q) / b, r.dot(P) / a + e);
+	Orbit.m_aPadding[0] = Orbit.m_aPadding[1] = Orbit.m_aPadding[2] = 0.0f;
+	return true;
+}
+
 void CTrajectories::Init()
 {
 	m_Shader.CompileShader(Shaders::VERT_TRAJECTORY, Shaders::FRAG_TRAJECTORY);
+	m_OrbitShader.CompileShader(Shaders::VERT_ORBIT, Shaders::FRAG_TRAJECTORY);
+	glGenBuffers(1, &m_OrbitBuffer);
 }
 
-void CTrajectories::Update(CStarSystem &PredictedSystem)
+int CTrajectories::GetStoredPointCount() const
 {
-	if(m_SampleRate <= 0)
-		return;
+	int Count = 0;
+	for(const auto &Traj : m_vPlanetTrajectories)
+		Count += (int)Traj.m_Count;
+	return Count;
+}
 
-	if(PredictedSystem.m_SimTick % m_SampleRate != 0)
-		return;
+uint64_t CTrajectories::GetNextSampleTick(const CStarSystem &PredictedSystem) const
+{
+	const uint64_t Tick = PredictedSystem.m_SimTick;
+	if(m_vPlanetTrajectories.size() != PredictedSystem.m_vBodies.size())
+		return Tick + 1;
 
-	int MaxPoints = GetMaxVisualPoints();
-	if(MaxPoints < 2)
-		return;
+	const double MaxAngle = glm::radians((double)m_MaxSampleAngle);
+	const uint64_t MaxInterval = GetMaxSampleInterval();
+	uint64_t NextTick = UINT64_MAX;
+
+	for(size_t i = 0; i < m_vPlanetTrajectories.size(); ++i)
+	{
+		const auto &Traj = m_vPlanetTrajectories[i];
+		if(Traj.m_Count == 0)
+			return Tick + 1;
+
+		NextTick = std::min(NextTick, Traj.Back() + MaxInterval);
 
+		if(Traj.m_Primary == -1)
+			continue;
+
+		// Extrapolate how long until the direction from the primary turned by MaxAngle
+		const auto &Body = PredictedSystem.m_vBodies[i].m_SimParams;
+		const auto &Primary = PredictedSystem.m_vBodies[Traj.m_Primary].m_SimParams;
+		Vec3 RelPos = Body.m_Position - Primary.m_Position;
+		Vec3 RelVel = Body.m_Velocity - Primary.m_Velocity;
+		double AngularRate = RelPos.cross(RelVel).length() / RelPos.dot(RelPos);
+		if(!(AngularRate > 0.0))
+			continue;
+
+		double Remaining = MaxAngle - AngleBetween(RelPos, Traj.m_LastRelPos);
+		if(Remaining <= 0.0)
+			return Tick + 1;
+
+		double Ticks = Remaining / AngularRate / PredictedSystem.m_DeltaTime;
+		NextTick = std::min(NextTick, Tick + std::max<uint64_t>(1, (uint64_t)std::min(Ticks, 1e15)));
+	}
+
+	return std::max(NextTick, Tick + 1);
+}
+
+void CTrajectories::Update(CStarSystem &PredictedSystem)
+{
 	if(m_vPlanetTrajectories.empty())
 	{
 		m_vPlanetTrajectories.resize(PredictedSystem.m_vBodies.size());
 		for(int i = 0; i < (int)m_vPlanetTrajectories.size(); ++i)
-		{
-			auto &Traj = m_vPlanetTrajectories[i];
-			Traj.m_Color = PredictedSystem.m_vBodies[i].m_RenderParams.m_Color;
-			glGenVertexArrays(1, &Traj.VAO);
-			glGenBuffers(1, &Traj.VBO);
-			Traj.m_PointCount = 0;
-		}
+			m_vPlanetTrajectories[i].m_PackedColor = PackColor(PredictedSystem.m_vBodies[i].m_RenderParams.m_Color);
+		if(!m_VAO)
+			glGenVertexArrays(1, &m_VAO);
+
+		const GLbitfield Flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		const size_t EndBytes = FRAMES * 2 * m_vPlanetTrajectories.size() * sizeof(SGPUEnd);
+		glGenBuffers(1, &m_EndBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_EndBuffer);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, EndBytes, nullptr, Flags);
+		m_pEnds = (SGPUEnd *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, EndBytes, Flags);
 	}
 
-	uint64_t VisualTick = PredictedSystem.m_SimTick / m_SampleRate;
-	size_t BufferIndex = VisualTick % MaxPoints;
+	const uint64_t Tick = PredictedSystem.m_SimTick;
+	const double MaxAngle = glm::radians((double)m_MaxSampleAngle);
+	const uint64_t MaxInterval = GetMaxSampleInterval();
 
 	for(size_t i = 0; i < PredictedSystem.m_vBodies.size(); ++i)
 	{
 		auto &Traj = m_vPlanetTrajectories[i];
 
-		if((int)Traj.m_PositionHistory.size() != MaxPoints)
+		// The predictor got re-seeded, drop what the old run predicted from here on
+		bool bSample = Traj.m_Count == 0;
+		while(Traj.m_Count > 0 && Traj.Back() >= Tick)
 		{
-			Traj.m_PositionHistory.resize(MaxPoints);
-			Traj.m_GLHistory.resize(MaxPoints + 2);
-			Traj.m_PointCount = 0;
-			glBindBuffer(GL_ARRAY_BUFFER, Traj.VBO);
-			glBufferData(GL_ARRAY_BUFFER, (MaxPoints + 2) * sizeof(glm::vec3), nullptr, GL_STREAM_DRAW);
+			Traj.m_vBlockSerials[Traj.Slot(Traj.m_Count - 1) / BLOCK_SIZE] = m_DrawSerial;
+			--Traj.m_Count;
+			bSample = true;
 		}
 
-		Traj.m_PositionHistory[BufferIndex] = PredictedSystem.m_vBodies[i].m_SimParams.m_Position;
+		const Vec3 &Pos = PredictedSystem.m_vBodies[i].m_SimParams.m_Position;
+		int Primary = PredictedSystem.FindPrimary(i);
+		Vec3 RelPos = (Primary != -1) ? Pos - PredictedSystem.m_vBodies[Primary].m_SimParams.m_Position : Pos;
+
+		if(!bSample)
+			bSample = Primary != Traj.m_Primary || Tick - Traj.Back() >= MaxInterval;
+		// GetNextSampleTick only extrapolates linearly, accept landing slightly short instead of creeping up tick by tick
+		if(!bSample && Primary != -1)
+			bSample = AngleBetween(RelPos, Traj.m_LastRelPos) >= MaxAngle * 0.9;
+		if(!bSample)
+			continue;
 
-		if(Traj.m_PointCount < MaxPoints)
-			Traj.m_PointCount++;
+		PushBack(i, Tick, Pos);
+		Traj.m_Primary = Primary;
+		Traj.m_LastRelPos = RelPos;
 	}
 }
 
 void CTrajectories::UpdateBuffers(CStarSystem &RealTimeSystem, CStarSystem &PredictedSystem, CCamera &Camera)
 {
-	if(m_vPlanetTrajectories.empty() || !m_Show || m_SampleRate <= 0)
-		return;
+	m_vFirsts.clear();
+	m_vCounts.clear();
+	m_vEndFirsts.clear();
+	m_vEndCounts.clear();
+	m_vOrbits.clear();
 
-	int maxPoints = GetMaxVisualPoints();
-	if(maxPoints < 2)
+	if(m_vPlanetTrajectories.empty())
 		return;
 
-	uint64_t SimTick = PredictedSystem.m_SimTick;
-	if(SimTick == 0)
+	if(m_vPlanetTrajectories.size() != PredictedSystem.m_vBodies.size() || m_vPlanetTrajectories.size() != RealTimeSystem.m_vBodies.size())
 		return;
 
-	uint64_t VisualTick = (SimTick - 1) / m_SampleRate;
-	size_t HeadIndex = VisualTick % maxPoints;
+	const uint64_t RealTick = RealTimeSystem.m_SimTick;
+	const uint64_t PredictedTick = PredictedSystem.m_SimTick;
+
+	// Keep exactly one sample at or before the real-time tick, it gets replaced by the real-time position below
+	for(auto &Traj : m_vPlanetTrajectories)
+	{
+		while(Traj.m_Count >= 2 && Traj.At(1) <= RealTick)
+		{
+			Traj.m_vBlockSerials[Traj.m_Tail / BLOCK_SIZE] = m_DrawSerial;
+			Traj.m_Tail = (Traj.m_Tail + 1) % Traj.Capacity();
+			--Traj.m_Count;
+		}
+	}
 
-	int RefIndex = Camera.m_pFocusedBody->m_Id;
+	if(!m_Show || PredictedTick == 0)
+		return;
 
-	// Get Reference Positions (Current and Future)
-	Vec3 RealTimeRefPos = (RefIndex != -1) ? RealTimeSystem.m_vBodies[RefIndex].m_SimParams.m_Position : Vec3(0.0);
-	Vec3 PredictedRefPos = (RefIndex != -1) ? PredictedSystem.m_vBodies[RefIndex].m_SimParams.m_Position : Vec3(0.0);
+	// The shader works relative to the reference body, centered on its current position
+	m_RefIndex = Camera.m_pFocusedBody ? Camera.m_pFocusedBody->m_Id : -1;
+	if(m_RefIndex != -1 && m_vPlanetTrajectories[m_RefIndex].m_Count == 0)
+		m_RefIndex = -1;
 
-	// Pre-calculate View Offset (Current Ref Pos relative to Camera)
-	// This centers the coordinate system on the Reference Body's CURRENT position
-	Vec3 ViewOffset = RealTimeRefPos - Camera.m_AbsolutePosition;
+	// Only the two ends of every path change from frame to frame: the real-time position in front and the
+	// predicted one behind the last sample. They go into the region of the upcoming draw, which is free once
+	// the draw FRAMES before it is done. The samples in between were written once.
+	const uint64_t Serial = m_DrawSerial + 1;
+	if(Serial > FRAMES)
+		WaitForDraw(Serial - FRAMES);
+	m_EndRegion = (Serial % FRAMES) * 2 * m_vPlanetTrajectories.size();
 
 	for(int i = 0; i < (int)m_vPlanetTrajectories.size(); ++i)
 	{
-		auto &Trajectory = m_vPlanetTrajectories[i];
-
-		if((int)Trajectory.m_PositionHistory.size() != maxPoints)
-			continue;
-		if((int)Trajectory.m_GLHistory.size() != maxPoints + 2)
+		auto &Traj = m_vPlanetTrajectories[i];
+		if(Traj.m_Count == 0)
 			continue;
 
-		int PointsToDraw = Trajectory.m_PointCount + 2; // Start + Samples + End
-
-		// START POINT (RealTime)
-		// Relative Pos = (Pos - RefPos)
-		// World Pos = CurrentRefPos + RelativePos
-		// GL Pos = World Pos - CameraPos = ViewOffset + RelativePos
-		Vec3 StartPos = RealTimeSystem.m_vBodies[i].m_SimParams.m_Position;
-		Vec3 RelStart = StartPos - RealTimeRefPos;
-
-		Trajectory.m_GLHistory[0] = (glm::vec3)(ViewOffset + RelStart);
-		if(Trajectory.m_GLHistory[0] == glm::vec3(0.0f))
-			Trajectory.m_GLHistory[0] = glm::vec3(0.0001f);
+		// The ring sample at index 0 is replaced by the real-time position, the strip runs over the rest
+		const bool bHasRing = Traj.m_Count >= 2;
+		const uint32_t FirstLink = bHasRing ? (uint32_t)(Traj.m_BaseSlot + Traj.Slot(1)) : NO_LINK;
+		const uint32_t LastLink = bHasRing ? (uint32_t)(Traj.m_BaseSlot + Traj.Slot(Traj.m_Count - 1)) : NO_LINK;
+		WriteEnd(i * 2, RealTick, RealTimeSystem.m_vBodies[i].m_SimParams.m_Position, FirstLink, Traj.m_PackedColor);
+		WriteEnd(i * 2 + 1, PredictedTick, PredictedSystem.m_vBodies[i].m_SimParams.m_Position, LastLink, Traj.m_PackedColor);
 
-		// HISTORY POINTS
-		if(Trajectory.m_PointCount > 0)
+		SGPUOrbit Orbit;
+		if(m_AnalyticOrbits && GetOrbit(RealTimeSystem, i, Camera.m_AbsolutePosition, Orbit))
 		{
-			size_t TailIndex = (HeadIndex - Trajectory.m_PointCount + 1 + maxPoints) % maxPoints;
-			for(int j = 0; j < Trajectory.m_PointCount; ++j)
-			{
-				size_t RingIndex = (TailIndex + j) % maxPoints;
-
-				Vec3 HistoryPos = Trajectory.m_PositionHistory[RingIndex];
-				Vec3 RefHistoryPos = (RefIndex != -1) ? m_vPlanetTrajectories[RefIndex].m_PositionHistory[RingIndex] : Vec3(0.0);
-
-				Vec3 RelHistory = HistoryPos - RefHistoryPos;
-
-				Trajectory.m_GLHistory[j + 1] = (glm::vec3)(ViewOffset + RelHistory);
-
-				if(Trajectory.m_GLHistory[j + 1] == glm::vec3(0.0f))
-					Trajectory.m_GLHistory[j + 1] = glm::vec3(0.0001f);
-			}
+			m_vOrbits.push_back(Orbit);
+			continue;
 		}
 
-		// END POINT (Predicted)
-		Vec3 EndPos = PredictedSystem.m_vBodies[i].m_SimParams.m_Position;
-		Vec3 RelEnd = EndPos - PredictedRefPos;
-
-		Trajectory.m_GLHistory[PointsToDraw - 1] = (glm::vec3)(ViewOffset + RelEnd);
-
-		if(Trajectory.m_GLHistory[PointsToDraw - 1] == glm::vec3(0.0f))
-			Trajectory.m_GLHistory[PointsToDraw - 1] = glm::vec3(0.0001f);
+		// A pair of segments joins the ends to the ring, see vert_trajectory.glsl
+		m_vEndFirsts.push_back(i * 4);
+		m_vEndCounts.push_back(4);
 
-		glBindVertexArray(Trajectory.VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, Trajectory.VBO);
-		glBufferSubData(GL_ARRAY_BUFFER, 0, PointsToDraw * sizeof(glm::vec3), Trajectory.m_GLHistory.data());
+		const size_t Points = Traj.m_Count - 1;
+		if(Points < 2)
+			continue;
+		const size_t Capacity = Traj.Capacity();
+		const size_t First = Traj.Slot(1);
+		if(First + Points <= Capacity + 1)
+		{
+			m_vFirsts.push_back((GLint)(Traj.m_BaseSlot + First));
+			m_vCounts.push_back((GLsizei)Points);
+		}
+		else
+		{
+			// Runs across the wrap, the first strip ends on the mirror of slot 0 and the second one starts there
+			m_vFirsts.push_back((GLint)(Traj.m_BaseSlot + First));
+			m_vCounts.push_back((GLsizei)(Capacity + 1 - First));
+			m_vFirsts.push_back((GLint)Traj.m_BaseSlot);
+			m_vCounts.push_back((GLsizei)(Points - (Capacity - First)));
+		}
+	}
 
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void *)0);
-		glEnableVertexAttribArray(0);
+	Vec3 RealTimeRefPos = (m_RefIndex != -1) ? RealTimeSystem.m_vBodies[m_RefIndex].m_SimParams.m_Position : Vec3(0.0);
+	m_ViewOffset = (glm::vec3)(RealTimeRefPos - Camera.m_AbsolutePosition);
+	m_RealTick = RealTick;
 
-		glBindVertexArray(0);
+	if(!m_vOrbits.empty())
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_OrbitBuffer);
+		if(m_vOrbits.size() > m_OrbitBufferCapacity)
+		{
+			m_OrbitBufferCapacity = std::max(m_vOrbits.size(), m_OrbitBufferCapacity * 2);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, m_OrbitBufferCapacity * sizeof(SGPUOrbit), nullptr, GL_STREAM_DRAW);
+		}
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_vOrbits.size() * sizeof(SGPUOrbit), m_vOrbits.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 	}
 }
 
 void CTrajectories::Render(CCamera &Camera)
 {
-	if(!m_Show || m_vPlanetTrajectories.empty())
+	if(!m_Show || (m_vEndFirsts.empty() && m_vOrbits.empty()))
 		return;
-	m_Shader.Use();
 
 	float F = 2.0f / log2(FAR_PLANE + 1.0f);
-	m_Shader.SetFloat("u_logDepthF", F);
-
-	auto Model = glm::mat4(1.0f);
-	m_Shader.SetMat4("Model", Model);
-	m_Shader.SetMat4("View", Camera.m_View);
-	m_Shader.SetMat4("Projection", Camera.m_Projection);
 	glEnable(GL_LINE_SMOOTH);
+	glLineWidth(m_LineWidth);
+	glBindVertexArray(m_VAO);
 
-	for(int i = 0; i < (int)m_vPlanetTrajectories.size(); ++i)
+	if(!m_vEndFirsts.empty())
 	{
-		auto &Trajectory = m_vPlanetTrajectories[i];
-		if(Trajectory.VAO == 0)
-			continue;
-
-		int count = Trajectory.m_PointCount + 2;
-		if(count < 2)
-			continue;
-
-		m_Shader.SetVec3("Color", Trajectory.m_Color);
-		glLineWidth(Trajectory.m_LineWidth);
+		m_Shader.Use();
+		m_Shader.SetFloat("u_logDepthF", F);
+		m_Shader.SetMat4("View", Camera.m_View);
+		m_Shader.SetMat4("Projection", Camera.m_Projection);
+		m_Shader.SetVec3("u_ViewOffset", m_ViewOffset);
+		m_Shader.SetUInt("u_RealTick", (uint32_t)m_RealTick);
+		m_Shader.SetUInt("u_EndBase", (uint32_t)m_EndRegion);
+
+		if(m_RefIndex != -1)
+		{
+			const auto &Ref = m_vPlanetTrajectories[m_RefIndex];
+			m_Shader.SetUInt("u_RefBase", (uint32_t)Ref.m_BaseSlot);
+			m_Shader.SetUInt("u_RefCapacity", (uint32_t)Ref.Capacity());
+			m_Shader.SetUInt("u_RefTail", (uint32_t)Ref.m_Tail);
+			m_Shader.SetUInt("u_RefCount", (uint32_t)Ref.m_Count + 1);
+			m_Shader.SetUInt("u_RefEnd", (uint32_t)m_RefIndex * 2);
+		}
+		else
+			m_Shader.SetUInt("u_RefCount", 0);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_SampleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_AnchorBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_EndBuffer);
+		m_Shader.SetBool("u_DrawEnds", false);
+		if(!m_vFirsts.empty())
+			glMultiDrawArrays(GL_LINE_STRIP, m_vFirsts.data(), m_vCounts.data(), (GLsizei)m_vFirsts.size());
+		m_Shader.SetBool("u_DrawEnds", true);
+		glMultiDrawArrays(GL_LINES, m_vEndFirsts.data(), m_vEndCounts.data(), (GLsizei)m_vEndFirsts.size());
+
+		// Writes into what these draws read wait for the fence, see WaitForDraw
+		const uint64_t Serial = ++m_DrawSerial;
+		const int Fence = Serial % FRAMES;
+		WaitForDraw(m_aFenceSerials[Fence]);
+		m_aDrawFences[Fence] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_aFenceSerials[Fence] = Serial;
+	}
 
-		glBindVertexArray(Trajectory.VAO);
-		glDrawArrays(GL_LINE_STRIP, 0, count);
-		glBindVertexArray(0);
+	if(!m_vOrbits.empty())
+	{
+		m_OrbitShader.Use();
+		m_OrbitShader.SetFloat("u_logDepthF", F);
+		m_OrbitShader.SetMat4("View", Camera.m_View);
+		m_OrbitShader.SetMat4("Projection", Camera.m_Projection);
+		m_OrbitShader.SetInt("u_Segments", std::max(m_OrbitSegments, 3));
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_OrbitBuffer);
+		glDrawArraysInstanced(GL_LINE_STRIP, 0, std::max(m_OrbitSegments, 3) + 1, (GLsizei)m_vOrbits.size());
 	}
+
+	glBindVertexArray(0);
 }
 
 void CTrajectories::Destroy()
 {
 	ClearTrajectories();
+	if(m_VAO)
+		glDeleteVertexArrays(1, &m_VAO);
+	m_VAO = 0;
+	if(m_OrbitBuffer)
+		glDeleteBuffers(1, &m_OrbitBuffer);
+	m_OrbitBuffer = 0;
+	m_OrbitBufferCapacity = 0;
 	m_Shader.Destroy();
+	m_OrbitShader.Destroy();
 }
 
 void CTrajectories::ClearTrajectories()
 {
-	for(auto &trajectory : m_vPlanetTrajectories)
+	for(uint64_t Serial : m_aFenceSerials)
+		WaitForDraw(Serial);
+	if(m_SampleBuffer)
 	{
-		if(trajectory.VAO)
-			glDeleteVertexArrays(1, &trajectory.VAO);
-		if(trajectory.VBO)
-			glDeleteBuffers(1, &trajectory.VBO);
+		glDeleteBuffers(1, &m_SampleBuffer);
+		glDeleteBuffers(1, &m_AnchorBuffer);
 	}
+	if(m_EndBuffer)
+		glDeleteBuffers(1, &m_EndBuffer);
+	m_SampleBuffer = m_AnchorBuffer = m_EndBuffer = 0;
+	m_pSamples = nullptr;
+	m_pAnchors = nullptr;
+	m_pEnds = nullptr;
 	m_vPlanetTrajectories.clear();
+	m_vFirsts.clear();
+	m_vCounts.clear();
+	m_vEndFirsts.clear();
+	m_vEndCounts.clear();
+	m_vOrbits.clear();
 }
@@ -3,6 +3,8 @@
 
 #include "../sim/starsystem.h"
 #include "shader.h"
+#include <algorithm>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <vector>
 
@@ -11,23 +13,140 @@ struct CCamera;
 
 class CTrajectories
 {
+	// Samples are grouped into blocks of BLOCK_SIZE ring slots. Each block has an anchor position split into a float
+	// and its rounding error, the samples only store a float offset to it. The error of a sample is bounded by
+	// 2^-24 of its distance to the anchor, so by the extent of the block instead of the distance to the origin.
+	static const int BLOCK_SIZE = 16;
+	// The ends of every path change each frame, so they get a region per frame in flight
+	static const int FRAMES = 3;
+	static const uint32_t NO_LINK = 0xffffffffu;
+
+	// GPU layouts, these match vert_trajectory.glsl
+	struct SGPUSample
+	{
+		float m_aOffset[3];
+		uint32_t m_Tick; // low 32 bits of the tick
+	};
+
+	struct SGPUAnchor
+	{
+		float m_aHigh[3];
+		uint32_t m_Color; // RGBA8
+		float m_aLow[3];
+		float m_Padding;
+	};
+
+	// Real-time or predicted end of a path, stored absolute
+	struct SGPUEnd
+	{
+		float m_aHigh[3];
+		uint32_t m_Tick;
+		float m_aLow[3];
+		uint32_t m_Link; // ring slot of the neighbouring sample, NO_LINK if there is none
+		uint32_t m_Color;
+		uint32_t m_aPadding[3];
+	};
+
+	// Osculating ellipse of a body around its primary, matches SOrbit in vert_orbit.glsl
+	struct SGPUOrbit
+	{
+		float m_aBodyOffset[3]; // body relative to the camera
+		float m_SemiMajorAxis;
+		float m_aPeriapsisDir[3];
+		float m_Eccentricity;
+		float m_aNormalDir[3]; // in the orbital plane, 90 degrees ahead of the periapsis
+		uint32_t m_Color;
+		float m_EccentricAnomaly; // of the body
+		float m_aPadding[3];
+	};
+
 	struct STrajectory
 	{
-		glm::vec3 m_Color;
-		std::vector<Vec3> m_PositionHistory;
-		std::vector<glm::vec3> m_GLHistory;
-		GLuint VAO = 0, VBO = 0;
-		float m_LineWidth = 2.0f;
-		int m_PointCount = 0;
+		uint32_t m_PackedColor = 0;
+
+		// Ring of sample ticks ordered by tick, the positions only live in the GPU buffers. Samples are written
+		// once, the real-time and the predicted end are kept apart in the end buffer.
+		// The region in the GPU buffers is followed by one more block mirroring the first slot so a line strip can run across the wrap.
+		std::vector<uint64_t> m_vTicks;
+		std::vector<Vec3> m_vAnchors; // per block
+		std::vector<uint64_t> m_vBlockSerials; // last draw that could have read the block
+		size_t m_Tail = 0;
+		size_t m_Count = 0;
+		size_t m_BaseSlot = 0; // always at a block boundary
+
+		// State at the last stored sample, used to decide when the path has curved enough
+		int m_Primary = -1;
+		Vec3 m_LastRelPos;
+
+		size_t Capacity() const { return m_vTicks.size(); }
+		size_t Slot(size_t i) const { return (m_Tail + i) % Capacity(); }
+		uint64_t At(size_t i) const { return m_vTicks[Slot(i)]; }
+		uint64_t Back() const { return At(m_Count - 1); }
 	};
+
 	CShader m_Shader;
 	std::vector<STrajectory> m_vPlanetTrajectories;
 
+	GLuint m_VAO = 0; // empty, the vertex shader pulls samples from m_SampleBuffer
+	GLuint m_SampleBuffer = 0, m_AnchorBuffer = 0;
+	// Persistently mapped
+	SGPUSample *m_pSamples = nullptr;
+	SGPUAnchor *m_pAnchors = nullptr;
+	// Two ends per body in each of the FRAMES regions
+	GLuint m_EndBuffer = 0;
+	SGPUEnd *m_pEnds = nullptr;
+	size_t m_EndRegion = 0; // first end of the region written this frame
+
+	// Serial of the draws reading the mapped buffers, the fence of a draw sits in slot serial % FRAMES
+	uint64_t m_DrawSerial = 0;
+	GLsync m_aDrawFences[FRAMES] = {};
+	uint64_t m_aFenceSerials[FRAMES] = {};
+
+	CShader m_OrbitShader;
+	GLuint m_OrbitBuffer = 0;
+	size_t m_OrbitBufferCapacity = 0;
+
+	// Draw state prepared by UpdateBuffers
+	std::vector<GLint> m_vFirsts;
+	std::vector<GLsizei> m_vCounts;
+	std::vector<GLint> m_vEndFirsts;
+	std::vector<GLsizei> m_vEndCounts;
+	glm::vec3 m_ViewOffset;
+	uint64_t m_RealTick = 0;
+	int m_RefIndex = -1;
+	std::vector<SGPUOrbit> m_vOrbits;
+
+	uint64_t GetMaxSampleInterval() const { return std::max<uint64_t>(1, (uint64_t)m_PredictionDuration / std::max(1, m_MinSamples)); }
+
+	void WaitForDraw(uint64_t Serial);
+	void Reallocate();
+	void WriteAnchor(STrajectory &Traj, size_t Block, const Vec3 &Pos);
+	void WriteSample(STrajectory &Traj, size_t i, uint64_t Tick, const Vec3 &Pos);
+	void WriteEnd(size_t End, uint64_t Tick, const Vec3 &Pos, uint32_t Link, uint32_t Color);
+	void PushBack(int Index, uint64_t Tick, const Vec3 &Pos);
+	bool GetOrbit(const CStarSystem &System, int Index, const Vec3 &CameraPos, SGPUOrbit &Orbit) const;
+
 public:
 	int m_PredictionDuration = 200000; // in ticks
-	int m_SampleRate = 2500;
-	int GetMaxVisualPoints() const { return (m_SampleRate > 0) ? (m_PredictionDuration / m_SampleRate) : 0; }
 
+	// A body gets a new sample once its direction as seen from its primary turned by this much
+	float m_MaxSampleAngle = 3.0f; // in degrees
+	// Lower bound of samples per body over the horizon, for bodies that barely curve
+	int m_MinSamples = 32;
+	int GetStoredPointCount() const;
+	uint64_t GetNextSampleTick(const CStarSystem &PredictedSystem) const;
+
+	// Predictor settings, see CPredictor
+	float m_PredictionTolerance = 1e-9f;
+	int m_ResyncInterval = 17280; // in ticks
+
+	// Bodies on a near-Keplerian orbit around the reference body are drawn as their osculating ellipse instead of the sampled path
+	bool m_AnalyticOrbits = true;
+	// Bodies whose acceleration relative to the reference body deviates more than this from the two-body one keep the sampled path
+	float m_MaxOrbitPerturbation = 0.02f;
+	int m_OrbitSegments = 256;
+
+	float m_LineWidth = 2.0f;
 	bool m_Show = true;
 	void Init();
 	void Update(CStarSystem &PredictedSystem);
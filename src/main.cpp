@@ -1,5 +1,6 @@
 #include "gfx/graphics.h"
 #include "gfx/trajectories.h"
+#include "sim/predictor.h"
 #include "sim/starsystem.h"
 #include <GLFW/glfw3.h>
 #include <chrono>
@@ -20,7 +21,8 @@ int main()
 	GfxEngine.m_Camera.SetBody(&StarSystem.m_vBodies.front());
 
 	// This is for the trajectories
-	CStarSystem PredictedStarSystem = StarSystem;
+	CPredictor Predictor;
+	Predictor.Resync(StarSystem);
 
 	using namespace std::chrono;
 	auto LastRenderTick = high_resolution_clock::now();
@@ -35,13 +37,15 @@ int main()
 		if(GfxEngine.m_bReloadRequested)
 		{
 			GfxEngine.ReloadSimulation();
-			PredictedStarSystem = StarSystem;
+			Predictor.Resync(StarSystem);
 			GfxEngine.m_bReloadRequested = false;
 		}
 
+		Predictor.m_Tolerance = GfxEngine.m_Trajectories.m_PredictionTolerance;
+		Predictor.m_ResyncInterval = (uint64_t)GfxEngine.m_Trajectories.m_ResyncInterval;
 		if(GfxEngine.m_bPredictionResetRequested)
 		{
-			PredictedStarSystem = StarSystem;
+			Predictor.Resync(StarSystem);
 			GfxEngine.m_bPredictionResetRequested = false;
 		}
 
@@ -61,17 +65,22 @@ int main()
 		else
 			AccTime = 0.0;
 
+		// The predictor drifts away from the leapfrog over time, re-seed it from the current tick every now and then
+		if(Predictor.NeedsResync(StarSystem))
+			Predictor.Resync(StarSystem);
+
 		// Advance prediction no matter if the real simulation is running, we never want to lag behind significantly
 		uint64_t Horizon = (uint64_t)GfxEngine.m_Trajectories.m_PredictionDuration;
 		uint64_t TargetTick = StarSystem.m_SimTick + Horizon;
-		while(PredictedStarSystem.m_SimTick < TargetTick)
+		while(Predictor.m_System.m_SimTick < TargetTick)
 		{
-			GfxEngine.m_Trajectories.Update(PredictedStarSystem);
-			PredictedStarSystem.UpdateBodies();
+			GfxEngine.m_Trajectories.Update(Predictor.m_System);
+			// never step over the next sample, so curved segments get their points where they bend
+			Predictor.Step(GfxEngine.m_Trajectories.GetNextSampleTick(Predictor.m_System));
 		}
 
 		GfxEngine.m_Camera.UpdateViewMatrix();
-		GfxEngine.m_Trajectories.UpdateBuffers(StarSystem, PredictedStarSystem, GfxEngine.m_Camera);
+		GfxEngine.m_Trajectories.UpdateBuffers(StarSystem, Predictor.m_System, GfxEngine.m_Camera);
 
 		GfxEngine.OnRender(StarSystem);
 	}
@@ -0,0 +1,164 @@
+#include "predictor.h"
+#include "body.h"
+#include "vmath.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Dormand-Prince 5(4) tableau
+static const double s_aaA[7][6] = {
+	{0.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+	{1.0 / 5.0, 0.0, 0.0, 0.0, 0.0, 0.0},
+	{3.0 / 40.0, 9.0 / 40.0, 0.0, 0.0, 0.0, 0.0},
+	{44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0, 0.0, 0.0, 0.0},
+	{19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0, 0.0, 0.0},
+	{9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0, 0.0},
+	{35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0}};
+
+// Difference between the 5th and the embedded 4th order weights
+static const double s_aErr[7] = {71.0 / 57600.0, 0.0, -71.0 / 16695.0, 71.0 / 1920.0, -17253.0 / 339200.0, 22.0 / 525.0, -1.0 / 40.0};
+
+void CPredictor::ComputeAccelerations(const std::vector<Vec3> &vPos, std::vector<Vec3> &vAcc, std::vector<double> *pNearestDist) const
+{
+	const size_t BodyCount = vPos.size();
+	for(size_t i = 0; i < BodyCount; ++i)
+		vAcc[i] = Vec3(0.0);
+	if(pNearestDist)
+		std::fill(pNearestDist->begin(), pNearestDist->end(), DBL_MAX);
+
+	for(size_t i = 0; i < BodyCount; ++i)
+	{
+		for(size_t j = i + 1; j < BodyCount; ++j)
+		{
+			Vec3 r = vPos[j] - vPos[i];
+			double DistSq = r.dot(r);
+			double Dist = std::sqrt(DistSq);
+			double CommonFactor = G / (DistSq * Dist);
+			Vec3 ForceVec = r * CommonFactor;
+			vAcc[i] += ForceVec * m_System.m_vBodies[j].m_SimParams.m_Mass;
+			vAcc[j] -= ForceVec * m_System.m_vBodies[i].m_SimParams.m_Mass;
+
+			if(pNearestDist)
+			{
+				(*pNearestDist)[i] = std::min((*pNearestDist)[i], Dist);
+				(*pNearestDist)[j] = std::min((*pNearestDist)[j], Dist);
+			}
+		}
+	}
+}
+
+void CPredictor::Resync(const CStarSystem &Authority)
+{
+	m_System = Authority;
+	m_SyncTick = Authority.m_SimTick;
+	m_bHasFirstStage = false;
+
+	const size_t BodyCount = m_System.m_vBodies.size();
+	m_vPos.resize(BodyCount);
+	m_vVel.resize(BodyCount);
+	m_vTmpPos.resize(BodyCount);
+	m_vTmpVel.resize(BodyCount);
+	for(int s = 0; s < 7; ++s)
+	{
+		m_avKPos[s].resize(BodyCount);
+		m_avKVel[s].resize(BodyCount);
+	}
+	m_vErrorScale.resize(BodyCount);
+	m_vNextErrorScale.resize(BodyCount);
+
+	for(size_t i = 0; i < BodyCount; ++i)
+	{
+		m_vPos[i] = m_System.m_vBodies[i].m_SimParams.m_Position;
+		m_vVel[i] = m_System.m_vBodies[i].m_SimParams.m_Velocity;
+	}
+}
+
+bool CPredictor::NeedsResync(const CStarSystem &Authority) const
+{
+	if(m_System.m_vBodies.size() != Authority.m_vBodies.size())
+		return true;
+	if(Authority.m_SimTick < m_SyncTick)
+		return true;
+	return m_ResyncInterval > 0 && Authority.m_SimTick - m_SyncTick >= m_ResyncInterval;
+}
+
+void CPredictor::Step(uint64_t MaxTick)
+{
+	const size_t BodyCount = m_vPos.size();
+	if(BodyCount == 0 || MaxTick <= m_System.m_SimTick)
+		return;
+
+	if(!m_bHasFirstStage)
+	{
+		m_avKPos[0] = m_vVel;
+		ComputeAccelerations(m_vPos, m_avKVel[0], &m_vErrorScale);
+		m_bHasFirstStage = true;
+	}
+
+	const double Tolerance = std::max(m_Tolerance, 1e-15);
+	while(true)
+	{
+		uint64_t StepTicks = std::clamp<uint64_t>(m_StepTicks, 1, MaxTick - m_System.m_SimTick);
+		const double Dt = (double)StepTicks * m_System.m_DeltaTime;
+
+		for(int s = 1; s < 7; ++s)
+		{
+			for(size_t i = 0; i < BodyCount; ++i)
+			{
+				Vec3 dPos(0.0), dVel(0.0);
+				for(int j = 0; j < s; ++j)
+				{
+					dPos += m_avKPos[j][i] * s_aaA[s][j];
+					dVel += m_avKVel[j][i] * s_aaA[s][j];
+				}
+				m_vTmpPos[i] = m_vPos[i] + dPos * Dt;
+				m_vTmpVel[i] = m_vVel[i] + dVel * Dt;
+			}
+			m_avKPos[s] = m_vTmpVel;
+			ComputeAccelerations(m_vTmpPos, m_avKVel[s], s == 6 ? &m_vNextErrorScale : nullptr);
+		}
+
+		// The last stage is evaluated at the 5th order solution, so m_vTmpPos/m_vTmpVel hold the candidate state
+		double ErrorNorm = 0.0;
+		for(size_t i = 0; i < BodyCount; ++i)
+		{
+			Vec3 Err(0.0);
+			for(int s = 0; s < 7; ++s)
+				Err += m_avKPos[s][i] * s_aErr[s];
+			ErrorNorm = std::max(ErrorNorm, (Err * Dt).length() / (Tolerance * m_vErrorScale[i]));
+		}
+
+		if(ErrorNorm <= 1.0 || StepTicks == 1)
+		{
+			m_vPos = m_vTmpPos;
+			m_vVel = m_vTmpVel;
+
+			// First same as last, the final stage is the first stage of the next step
+			std::swap(m_avKPos[0], m_avKPos[6]);
+			std::swap(m_avKVel[0], m_avKVel[6]);
+			std::swap(m_vErrorScale, m_vNextErrorScale);
+
+			for(size_t i = 0; i < BodyCount; ++i)
+			{
+				auto &Params = m_System.m_vBodies[i].m_SimParams;
+				Params.m_Position = m_vPos[i];
+				Params.m_Velocity = m_vVel[i];
+				Params.m_Acceleration = m_avKVel[0][i];
+				IntegrateRotation(Params.m_Orientation, Params.m_AngularVelocity, Dt);
+			}
+			m_System.m_SimTick += StepTicks;
+
+			double Factor = ErrorNorm > 0.0 ? std::clamp(0.9 * std::pow(ErrorNorm, -0.2), 0.2, 5.0) : 5.0;
+			uint64_t Proposal = std::max<uint64_t>(1, (uint64_t)((double)StepTicks * Factor));
+			// A step cut short by MaxTick says nothing about larger steps, so only let it shrink the proposal
+			if(StepTicks < m_StepTicks)
+				m_StepTicks = std::min(m_StepTicks, std::max(Proposal, StepTicks));
+			else
+				m_StepTicks = Proposal;
+			return;
+		}
+
+		double Factor = std::clamp(0.9 * std::pow(ErrorNorm, -0.25), 0.1, 0.9);
+		m_StepTicks = std::max<uint64_t>(1, (uint64_t)((double)StepTicks * Factor));
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include "starsystem.h"
+#include <cstdint>
+#include <vector>
+
+// Runs a private copy of the star system ahead of the real-time one for the trajectories.
+// Instead of the fixed 5s leapfrog it uses an adaptive Dormand-Prince 5(4) integrator.
+// Steps are always whole multiples of m_DeltaTime so m_SimTick stays comparable to the real system.
+class CPredictor
+{
+	// Scratch buffers, kept around so stepping does not allocate
+	std::vector<Vec3> m_vPos, m_vVel;
+	std::vector<Vec3> m_vTmpPos, m_vTmpVel;
+	std::vector<Vec3> m_avKPos[7], m_avKVel[7];
+	std::vector<double> m_vErrorScale, m_vNextErrorScale;
+	bool m_bHasFirstStage = false;
+
+	void ComputeAccelerations(const std::vector<Vec3> &vPos, std::vector<Vec3> &vAcc, std::vector<double> *pNearestDist = nullptr) const;
+
+public:
+	CStarSystem m_System;
+
+	double m_Tolerance = 1e-9; // Max position error per step relative to the distance to the nearest body
+	uint64_t m_ResyncInterval = 17280; // Re-seed from the real system every n real ticks (1 day at 5s)
+	uint64_t m_SyncTick = 0; // Real tick of the last re-seed
+	uint64_t m_StepTicks = 1; // Current step size proposal in ticks
+
+	void Resync(const CStarSystem &Authority);
+	bool NeedsResync(const CStarSystem &Authority) const;
+
+	// Advances by one adaptive step, never past MaxTick
+	void Step(uint64_t MaxTick);
+};
+
+#endif // PREDICTOR_H
@@ -49,6 +49,28 @@ void CStarSystem::UpdateBodies()
 	++m_SimTick;
 }
 
+int CStarSystem::FindPrimary(size_t Index) const
+{
+	// Pick the heavier body whose hill sphere we are deepest in, the hill radius scales with cbrt(mass)
+	const auto &Body = m_vBodies[Index].m_SimParams;
+	int Primary = -1;
+	double BestScore = 0.0;
+	for(size_t i = 0; i < m_vBodies.size(); ++i)
+	{
+		const auto &Other = m_vBodies[i].m_SimParams;
+		if(i == Index || Other.m_Mass <= Body.m_Mass)
+			continue;
+
+		double Score = distance(Body.m_Position, Other.m_Position) / std::cbrt(Other.m_Mass);
+		if(Primary == -1 || Score < BestScore)
+		{
+			Primary = (int)i;
+			BestScore = Score;
+		}
+	}
+	return Primary;
+}
+
 int CStarSystem::Benchmark()
 {
 	using namespace std::chrono;
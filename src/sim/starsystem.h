@@ -19,6 +19,7 @@ struct CStarSystem
 	void OnInit();
 	void LoadBodies(const std::string &filename);
 	void UpdateBodies();
+	int FindPrimary(size_t Index) const; // index of the body Index orbits, -1 if none
 	int Benchmark(); // returns TPS
 };
 